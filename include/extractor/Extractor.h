@@ -3,6 +3,7 @@
 
 #include <support/TreeSitter/TreeSitter.h>
 #include <support/ThreadPool/ThreadPool.h>
+#include <support/Support/Positions.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -47,6 +48,7 @@ extract(const std::filesystem::path &file, const Parameters &params, const std::
     auto outFile = tempDir / "tokens" / (id + ".txt");
     auto outSubs = tempDir / "submissions" / (id + ".txt");
     auto outVocab = tempDir / "vocabs" / (id + ".json");
+    auto outPositions = tempDir / "positions" / (id + ".bin");
     {
         std::ofstream tempFile(outFile, std::ios::app);
         tempFile << line;
@@ -59,6 +61,12 @@ extract(const std::filesystem::path &file, const Parameters &params, const std::
         tempFile.close();
     }
 
+    if (params.positions) {
+        std::ofstream tempFile(outPositions, std::ios::app | std::ios::binary);
+        support::writePositionsRecord(tempFile, t.positions);
+        tempFile.close();
+    }
+
     json threadVocab = json::object();
 
     {
@@ -85,6 +93,7 @@ extract(const std::filesystem::path &file, const Parameters &params, const std::
 /// >> labels.txt
 /// >> submissions.txt
 /// >> mapping.json
+/// >> positions.bin (optional, see support::positions)
 /// @brief - Uses threadpool
 class Extractor
 {
@@ -107,6 +116,7 @@ class Extractor
         std::filesystem::create_directory(tokensDir / "temp" / "tokens");
         std::filesystem::create_directory(tokensDir / "temp" / "submissions");
         std::filesystem::create_directory(tokensDir / "temp" / "vocabs");
+        std::filesystem::create_directory(tokensDir / "temp" / "positions");
 
         std::vector<std::filesystem::path> filePaths;
         for (auto const &dir_entry : std::filesystem::directory_iterator{dirPath}) {
@@ -115,13 +125,11 @@ class Extractor
 
         std::filesystem::path tempDir = tokensDir / "temp";
 
-        // run threadpool
+        // run threadpool, one file at a time: their sizes differ too much for larger chunks
         {
             threadpool::ThreadPool pool(params.numThreads);
-            for (auto &file : filePaths) {
-                auto res =
-                    pool.addTask(extractor::extract<Parameters>, std::ref(file), std::ref(params), std::ref(tempDir));
-            }
+            pool.parallelFor(0, filePaths.size(), 1,
+                             [&](size_t i) { extractor::extract<Parameters>(filePaths[i], params, tempDir); });
         }
 
         std::set<std::string> threadIDs;
@@ -151,6 +159,7 @@ class Extractor
             outFile.close();
         }
         std::unordered_map<std::string, std::string> sub2label;
+        size_t numDocs = 0;
 
         {
             std::ifstream labelsVocab(labelsPath);
@@ -169,11 +178,24 @@ class Extractor
             std::string line;
             while (std::getline(inFile, line)) {
                 outFile << sub2label[line] << "\n";
+                ++numDocs;
             }
             inFile.close();
             outFile.close();
         }
 
+        if (params.positions) {
+            // unite all files with positions into one, in the order of tokens.txt
+            std::ofstream outFile(tokensDir / "positions.bin", std::ios::binary);
+            support::writePositionsHeader(outFile, numDocs);
+            for (auto const &threadID : threadIDs) {
+                std::ifstream f(tokensDir / "temp" / "positions" / (threadID + ".bin"), std::ios::binary);
+                outFile << f.rdbuf();
+                f.close();
+            }
+            outFile.close();
+        }
+
         // create a global vocabulary
         json globalVocab = json::object();
 
@@ -0,0 +1,193 @@
+#ifndef MODEL_BUNDLE_H
+#define MODEL_BUNDLE_H
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace model
+{
+
+/// Single-file model format
+/// @brief - [Header][Section table][Section 0]...[Section n], every section starts at a 64-byte aligned offset
+/// @brief - all values are little-endian, matrices are stored as they are laid out in memory by Eigen
+/// @brief - each section has an FNV-1a checksum, the header and the section table are covered by their own checksum
+namespace bundle
+{
+
+constexpr char magic[8] = {'A', 'S', 'T', 'C', 'O', 'D', 'A', 'B'};
+constexpr uint32_t version = 1;
+constexpr size_t alignment = 64;
+
+enum class DType : uint32_t { Float32 = 0, UInt32 = 1, UInt64 = 2, Char = 3 };
+
+enum class SectionId : uint32_t {
+    // [numTokens, embDim], row-major
+    Embeddings = 0,
+    // [numTokens + 1], see TokenIndex
+    TokenOffsets = 1,
+    TokenStrings = 2,
+    TokenSlots = 3,
+    // [numDomains, numFilters]
+    AttentionDomains = 4,
+    // [numFilters, embDim * kernelSize], Batch Normalization is folded in
+    ConvMatrix = 5,
+    // [numFilters]
+    ConvBias = 6,
+    // [numClasses * numDomains, numFilters]
+    FcMatrix = 7,
+    // [numClasses * numDomains]
+    FcBias = 8,
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t numSections;
+    uint64_t embDim;
+    uint64_t kernelSize;
+    uint64_t numFilters;
+    uint64_t numClasses;
+    uint64_t numDomains;
+    uint64_t numTokens;
+    // checksum of the header (with this field set to 0) and the section table
+    uint64_t checksum;
+};
+
+struct Section {
+    SectionId id;
+    DType dtype;
+    uint64_t rows;
+    uint64_t cols;
+    // offset from the beginning of the file
+    uint64_t offset;
+    // size in bytes
+    uint64_t size;
+    uint64_t checksum;
+};
+
+static_assert(sizeof(Header) == 72 && sizeof(Section) == 48, "The bundle layout must not depend on the compiler");
+// sections are mapped and used in place, so the stored byte order must be the native one
+static_assert(std::endian::native == std::endian::little, "Bundles are little-endian");
+
+/// One tensor to be written into a bundle
+struct Tensor {
+    SectionId id;
+    DType dtype;
+    uint64_t rows;
+    uint64_t cols;
+    std::span<const char> bytes;
+};
+
+/// Function that computes the 64-bit FNV-1a checksum of a buffer
+uint64_t checksum(std::span<const char> bytes, uint64_t seed = 14695981039346656037ull);
+
+/// Function that writes a bundle
+/// @param path - output file
+/// @param header - shapes (magic, version, numSections and checksum are filled in)
+/// @param tensors - sections to write
+void write(const std::filesystem::path &path, Header header, const std::vector<Tensor> &tensors);
+
+} // namespace bundle
+
+/// Read-only memory mapping of a whole file
+/// @brief - pages are shared between all the processes that map the same file
+class MappedFile
+{
+    const char *ptr = nullptr;
+    size_t length = 0;
+
+  public:
+    explicit MappedFile(const std::filesystem::path &path);
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+    const char *
+    data() const
+    {
+        return ptr;
+    }
+
+    size_t
+    size() const
+    {
+        return length;
+    }
+};
+
+/// Memory-mapped model bundle
+class Bundle
+{
+    std::shared_ptr<const MappedFile> file;
+    const bundle::Header *head;
+    std::span<const bundle::Section> sections;
+
+  public:
+    /// Map a bundle and validate its header and section table
+    /// @param path - path to the bundle
+    /// @param verify - also verify the checksums of all the sections (reads the whole file)
+    explicit Bundle(const std::filesystem::path &path, bool verify = false);
+
+    const bundle::Header &
+    header() const
+    {
+        return *head;
+    }
+
+    /// Mapping that keeps the sections alive
+    std::shared_ptr<const void>
+    storage() const
+    {
+        return file;
+    }
+
+    /// Get a section's description
+    const bundle::Section &section(bundle::SectionId id) const;
+
+    /// Get a section's contents
+    /// @tparam T - element type, must correspond to the section's dtype
+    /// @param id - section id
+    /// @param rows - expected number of rows
+    /// @param cols - expected number of columns
+    template <typename T>
+    std::span<const T>
+    get(bundle::SectionId id, uint64_t rows, uint64_t cols = 1) const
+    {
+        auto &s = section(id);
+        if (s.dtype != dtypeOf<T>() || s.rows != rows || s.cols != cols || s.size != rows * cols * sizeof(T)) {
+            throw std::runtime_error("Bundle section " + std::to_string(uint32_t(id)) +
+                                     " doesn't match expected tensor dimensions!");
+        }
+        return {reinterpret_cast<const T *>(file->data() + s.offset), rows * cols};
+    }
+
+    template <typename T>
+    static constexpr bundle::DType
+    dtypeOf()
+    {
+        if constexpr (std::same_as<T, float>) {
+            return bundle::DType::Float32;
+        } else if constexpr (std::same_as<T, uint32_t>) {
+            return bundle::DType::UInt32;
+        } else if constexpr (std::same_as<T, uint64_t>) {
+            return bundle::DType::UInt64;
+        } else {
+            static_assert(std::same_as<T, char>, "Unsupported bundle dtype");
+            return bundle::DType::Char;
+        }
+    }
+};
+
+} // namespace model
+
+#endif
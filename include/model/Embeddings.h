@@ -0,0 +1,292 @@
+#ifndef MODEL_EMBEDDINGS_H
+#define MODEL_EMBEDDINGS_H
+
+#include <Eigen/Dense>
+#include <model/Half.h>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace model
+{
+
+/// Row-major matrix: each row is stored contiguously
+using RowMatrixXf = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+/// Function that hashes a path-token (64-bit FNV-1a)
+/// @brief - the hash is a part of the bundle format, so it mustn't depend on the standard library implementation
+uint64_t hashToken(std::string_view token);
+
+/// Open-addressing hash table that maps path-tokens to rows of the embedding table
+/// @brief - the table is stored in three flat arrays, so it can be either built in memory or mapped from a bundle
+/// @brief - token i is strings[offsets[i], offsets[i + 1])
+/// @brief - slots[hash & (numSlots - 1)] (linear probing) stores row + 1 of the token, 0 marks an empty slot
+class TokenIndex
+{
+    // [numTokens + 1]
+    std::span<const uint64_t> offsets;
+    std::string_view strings;
+    // [numSlots], numSlots is a power of 2
+    std::span<const uint32_t> slots;
+
+    // arrays owned by the index when it is built in memory
+    std::vector<uint64_t> ownOffsets;
+    std::vector<char> ownStrings;
+    std::vector<uint32_t> ownSlots;
+
+  public:
+    TokenIndex() = default;
+
+    /// Build the index in memory
+    /// @param tokens - path-tokens, the i'th token corresponds to the i'th row
+    explicit TokenIndex(const std::vector<std::string> &tokens);
+
+    /// Wrap already built arrays (e.g. mapped from a bundle)
+    TokenIndex(std::span<const uint64_t> offsets, std::string_view strings, std::span<const uint32_t> slots);
+
+    TokenIndex(TokenIndex &&) = default;
+    TokenIndex &operator=(TokenIndex &&) = default;
+    TokenIndex(const TokenIndex &) = delete;
+    TokenIndex &operator=(const TokenIndex &) = delete;
+
+    /// Function that finds the row of a path-token
+    /// @param token - path-token
+    /// @return the row if the token exists
+    std::optional<size_t> find(std::string_view token) const;
+
+    /// Get the path-token stored in the given row
+    std::string_view token(size_t row) const;
+
+    size_t
+    size() const
+    {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    std::span<const uint64_t>
+    getOffsets() const
+    {
+        return offsets;
+    }
+
+    std::string_view
+    getStrings() const
+    {
+        return strings;
+    }
+
+    std::span<const uint32_t>
+    getSlots() const
+    {
+        return slots;
+    }
+};
+
+/// Codebooks of a product-quantized embedding table
+/// @brief - a vector is split into numSubspaces sub-vectors of embDim / numSubspaces floats, each sub-vector is stored
+/// as the index of a centroid of its subspace
+struct PqCodebook {
+    size_t numSubspaces = 0;
+    // at most 256, so an index is one byte
+    size_t numCentroids = 0;
+    // [numSubspaces][numCentroids][embDim / numSubspaces]
+    std::vector<float> centroids;
+};
+
+/// Embedding table
+/// @brief - all the vectors are stored in one contiguous [numTokens, embDim] row-major matrix
+/// @brief - path-tokens are mapped to the rows of this matrix by a separate index
+/// @brief - the matrix is either owned or mapped from a bundle (then storage keeps the mapping alive)
+/// @brief - alternatively the table is product-quantized (see model::pq): [numTokens, numSubspaces] codes and the
+/// codebooks, rows are decoded on the fly
+/// @brief - or it is stored in fp16/bf16 (see model::half), rows are widened on the fly
+class Embeddings
+{
+    // memory the table is mapped onto, if any
+    std::shared_ptr<const void> storage;
+    // owned table
+    RowMatrixXf ownVectors;
+
+    // [numTokens, embDim]
+    const float *data = nullptr;
+    size_t numTokens = 0;
+    size_t embDim = 0;
+
+    // [numTokens, numSubspaces] codes of a product-quantized table
+    std::vector<uint8_t> codes;
+    PqCodebook codebook;
+
+    // [numTokens, embDim] table stored in 16 bits
+    std::vector<uint16_t> halfVectors;
+    half::DType type = half::DType::Float32;
+
+    TokenIndex index;
+    // row of the "@@UNK@@" token
+    size_t unkIdx = 0;
+
+  public:
+    Embeddings() = default;
+
+    /// Own the given table
+    Embeddings(RowMatrixXf vectors, TokenIndex index);
+
+    /// Wrap an external [numTokens, embDim] table
+    Embeddings(std::shared_ptr<const void> storage, const float *data, size_t numTokens, size_t embDim,
+               TokenIndex index);
+
+    /// Own a product-quantized table
+    /// @param codes - [numTokens, codebook.numSubspaces] centroid indices
+    Embeddings(std::vector<uint8_t> codes, PqCodebook codebook, size_t embDim, TokenIndex index);
+
+    /// Own a table stored in 16 bits
+    /// @param vectors - [numTokens, embDim] row-major fp16 or bf16 values
+    Embeddings(std::vector<uint16_t> vectors, half::DType dtype, size_t embDim, TokenIndex index);
+
+    Embeddings(Embeddings &&) = default;
+    Embeddings &operator=(Embeddings &&) = default;
+
+    /// Function that finds the row of a path-token
+    /// @param token - path-token
+    /// @return the row of the token if exists, otherwise the row of "@@UNK@@"
+    size_t find(std::string_view token) const;
+
+    /// Whether both tables have the same path-tokens in the same rows and decode them to the same vectors
+    bool sameAs(const Embeddings &other) const;
+
+    /// Whether the table is product-quantized
+    bool
+    quantized() const
+    {
+        return codebook.numSubspaces != 0;
+    }
+
+    /// Storage type of a table that isn't product-quantized
+    half::DType
+    dtype() const
+    {
+        return type;
+    }
+
+    /// Whether the table is a fp32 matrix, otherwise vectors() and row() aren't available, use decode()
+    bool
+    dense() const
+    {
+        return !quantized() && type == half::DType::Float32;
+    }
+
+    /// Function that writes the i'th vector
+    /// @param dst - [embDim] output
+    void
+    decode(size_t i, float *dst) const
+    {
+        if (dense()) {
+            std::copy(data + i * embDim, data + (i + 1) * embDim, dst);
+            return;
+        }
+        if (!quantized()) {
+            half::widen(type, halfVectors.data() + i * embDim, embDim, dst);
+            return;
+        }
+        auto subDim = embDim / codebook.numSubspaces;
+        auto *code = codes.data() + i * codebook.numSubspaces;
+        for (size_t s = 0; s < codebook.numSubspaces; ++s, dst += subDim) {
+            auto *centroid = codebook.centroids.data() + (s * codebook.numCentroids + code[s]) * subDim;
+            std::copy(centroid, centroid + subDim, dst);
+        }
+    }
+
+    const PqCodebook &
+    pqCodebook() const
+    {
+        return codebook;
+    }
+
+    /// [numTokens, numSubspaces] codes of a product-quantized table
+    std::span<const uint8_t>
+    pqCodes() const
+    {
+        return codes;
+    }
+
+    /// Memory taken by the vectors (or the codes and the codebooks)
+    size_t
+    bytes() const
+    {
+        return quantized() ? codes.size() + codebook.centroids.size() * sizeof(float)
+                           : numTokens * embDim * half::elementSize(type);
+    }
+
+    /// [numTokens, embDim] values of a table stored in 16 bits
+    std::span<const uint16_t>
+    halfData() const
+    {
+        return halfVectors;
+    }
+
+    /// [numTokens, embDim]
+    Eigen::Map<const RowMatrixXf>
+    vectors() const
+    {
+        return {data, static_cast<Eigen::Index>(numTokens), static_cast<Eigen::Index>(embDim)};
+    }
+
+    /// [embDim]
+    Eigen::Map<const Eigen::VectorXf>
+    row(size_t i) const
+    {
+        return {data + i * embDim, static_cast<Eigen::Index>(embDim)};
+    }
+
+    const TokenIndex &
+    tokens() const
+    {
+        return index;
+    }
+
+    size_t
+    size() const
+    {
+        return numTokens;
+    }
+
+    size_t
+    dim() const
+    {
+        return embDim;
+    }
+
+    size_t
+    unk() const
+    {
+        return unkIdx;
+    }
+};
+
+/// Function that loads embeddings stored in the word2vec binary format or product-quantized ones (see model::pq)
+/// @brief - a 16-bit table has the type after the sizes in the header ("numTokens embDim fp16") and 16-bit values
+/// @brief - the file is memory-mapped, the rows of a large table are copied by several threads
+/// @param filename - path to embeddings.bin
+/// @param vocabulary - if not empty, only the vectors of these path-tokens (and "@@UNK@@") are kept, the others are
+/// skipped without being read into memory
+/// @param dtype - storage type of the file, must match its header
+Embeddings loadEmbeddings(const std::filesystem::path &filename, const std::unordered_set<std::string> &vocabulary = {},
+                          half::DType dtype = half::DType::Float32);
+
+/// Function that writes embeddings in the word2vec binary format
+/// @param dtype - storage type of the vectors, 16-bit types are marked in the header
+void saveEmbeddings(const std::filesystem::path &filename, const Embeddings &embeddings,
+                    half::DType dtype = half::DType::Float32);
+
+} // namespace model
+
+#endif
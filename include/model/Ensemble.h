@@ -0,0 +1,94 @@
+#ifndef MODEL_ENSEMBLE_H
+#define MODEL_ENSEMBLE_H
+
+#include <model/Model.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace model
+{
+
+/// How the lines chosen by the models of an ensemble are combined
+/// @brief - a line is chosen if the models that chose it have a total weight of at least quorum
+/// @brief - if no line is chosen, the submission is considered human-written: {0}, as in chooseLines
+struct Voting {
+    // [numModels] weight of each model's vote, 1 for every model if empty
+    std::vector<double> weights;
+    double quorum = 1;
+
+    /// One model is enough: the union of the chosen lines
+    static Voting any();
+
+    /// More than half of the models
+    static Voting majority(size_t numModels);
+
+    /// Every model: the intersection of the chosen lines
+    static Voting all(size_t numModels);
+};
+
+/// Several models run over the same submissions
+/// @brief - a submission is parsed once for all the models, so they must have the same language and minimum
+/// path-token length
+/// @brief - models with equal embedding tables share one table (see ASTCODAModel::shareEmbeddings), and the
+/// embeddings of a batch are gathered once for the ones that read them (see ASTCODAModel::gatherBatch): the models
+/// with the kernel size of the first one convolve them in place, the others copy them instead of looking them up
+/// @brief - inference methods are const and reentrant, as the ones of ASTCODAModel
+class Ensemble
+{
+    std::vector<std::unique_ptr<ASTCODAModel>> models;
+    Voting voting;
+    // models[i] uses the table of models[tableOwner[i]]
+    std::vector<size_t> tableOwner;
+
+  public:
+    /// @param models - models with the same language, minimum path-token length and domains
+    /// @param voting - how the chosen lines are combined, its weights (if any) are given for each model
+    Ensemble(std::vector<std::unique_ptr<ASTCODAModel>> models, Voting voting);
+
+    size_t
+    size() const
+    {
+        return models.size();
+    }
+
+    const ASTCODAModel &
+    model(size_t i) const
+    {
+        return *models[i];
+    }
+
+    /// Number of distinct embedding tables
+    size_t numTables() const;
+
+    /// Function that parses one submission into path-tokens, once for all the models
+    /// @param filePath - path to the submission
+    Document parse(const std::string &filePath) const;
+
+    /// Function that runs every model over a batch of parsed submissions
+    /// @param docs - parsed submissions
+    /// @param domainIdx - domain which each submission belongs to
+    /// @return [numModels][numDocs] predictions
+    std::vector<std::vector<Prediction>> predictBatch(std::span<const Document *const> docs,
+                                                      std::span<const size_t> domainIdx) const;
+
+    /// Function that combines the lines chosen by the models
+    /// @param choices - [numModels] output of chooseLines for each model
+    std::set<size_t> vote(const std::vector<std::set<size_t>> &choices) const;
+
+    /// Function that processes one submission: each model chooses lines with its own threshold, then they vote
+    /// @param filePath - path to the submission
+    /// @param domainIdx - domain which the submission belongs to
+    std::set<size_t> run(const std::string &filePath, size_t domainIdx) const;
+
+    /// Function that processes a batch of parsed submissions, results are the same as of run() for each one
+    /// @param docs - parsed submissions
+    /// @param domainIdx - domain which each submission belongs to
+    std::vector<std::set<size_t>> runBatch(const std::vector<Document> &docs,
+                                           const std::vector<size_t> &domainIdx) const;
+};
+
+} // namespace model
+
+#endif
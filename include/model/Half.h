@@ -0,0 +1,60 @@
+#ifndef MODEL_HALF_H
+#define MODEL_HALF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace model
+{
+
+/// Half-precision storage of weights
+/// @brief - values are stored in 16 bits and widened to fp32 right before they are used, arithmetic stays in fp32
+/// @brief - widening uses AVX-512 or F16C instructions chosen at run time, or plain C++
+namespace half
+{
+
+/// Storage type of weights
+/// @brief - Float16: IEEE binary16, 11-bit precision, values up to 65504
+/// @brief - BFloat16: the upper half of fp32, 8-bit precision, the range of fp32
+enum class DType { Float32, Float16, BFloat16 };
+
+/// Size of one value in bytes
+size_t elementSize(DType dtype);
+
+/// @return "fp32", "fp16" or "bf16"
+std::string dtypeName(DType dtype);
+
+/// Function that parses the result of dtypeName
+DType parseDType(const std::string &name);
+
+/// Function that rounds a float to the nearest fp16 value (ties to even), values beyond the range become infinities
+uint16_t toFloat16(float value);
+
+float fromFloat16(uint16_t value);
+
+/// Function that rounds a float to the nearest bf16 value (ties to even)
+uint16_t toBFloat16(float value);
+
+float fromBFloat16(uint16_t value);
+
+/// Function that converts 16-bit values to fp32
+/// @param dtype - Float16 or BFloat16
+/// @param src - [n] values
+/// @param dst - [n] output
+void widen(DType dtype, const uint16_t *src, size_t n, float *dst);
+
+/// Function that rounds fp32 values to 16 bits
+/// @param dtype - Float16 or BFloat16
+/// @param src - [n] values
+/// @param dst - [n] output
+void narrow(DType dtype, const float *src, size_t n, uint16_t *dst);
+
+/// Name of the instruction set used by widen: "avx512", "f16c" or "scalar"
+std::string widenIsaName();
+
+} // namespace half
+
+} // namespace model
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef MODEL_KERNELS_H
+#define MODEL_KERNELS_H
+
+#include <model/Embeddings.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace model
+{
+
+/// Shape-dependent fp32 inference kernels
+/// @brief - the kernels are templates over embDim, kernelSize and numFilters: for the registered shapes all of them are
+/// compile-time constants (fixed-size vectors, compile-time window stride), any other shape uses the dynamic instance
+namespace kernels
+{
+
+struct Shape {
+    size_t embDim;
+    size_t kernelSize;
+    size_t numFilters;
+};
+
+/// Function that gathers the embeddings of path-tokens into consecutive rows
+/// @param dst - [tokens.size() * embDim] output
+using GatherKernel = void (*)(const Embeddings &embeddings, const std::vector<std::string> &tokens, float *dst);
+
+/// Function that applies the convolution to consecutive windows
+/// @param conv - [numFilters, embDim * kernelSize] convolution matrix
+/// @param packed - packed embeddings, the i'th window is packed[i * embDim, (i + kernelSize) * embDim)
+/// @param features - [numFilters, numWindows] output
+using ConvolveKernel = void (*)(const float *conv, const float *packed, size_t numWindows, float *features,
+                                const Shape &shape);
+
+/// Function that applies bias, ReLU, domain attention and softmax pooling to a document's features in a single pass
+/// @param features - [numFilters, numWindows] convolution outputs, bias and ReLU are applied in place
+/// @param bias - [numFilters]
+/// @param domain - [numFilters] domain vector
+/// @param attention - [numWindows] output attention weights
+/// @param pooled - [numFilters] output representation
+using PoolKernel = void (*)(float *features, size_t numWindows, const float *bias, const float *domain,
+                            float *attention, float *pooled, const Shape &shape);
+
+/// Function that applies all the fully-connected heads
+/// @param fc - [numOutputs, numFilters]
+/// @param bias - [numOutputs]
+/// @param pooled - [numFilters]
+/// @param logits - [numOutputs] output
+using FullyConnectedKernel = void (*)(const float *fc, const float *bias, size_t numOutputs, const float *pooled,
+                                      float *logits, const Shape &shape);
+
+struct Kernels {
+    // shape the kernels are specialized for, zeros for the dynamic instance
+    Shape shape;
+    GatherKernel gather;
+    ConvolveKernel convolve;
+    PoolKernel pool;
+    FullyConnectedKernel fullyConnected;
+
+    bool
+    specialized() const
+    {
+        return shape.embDim != 0;
+    }
+};
+
+/// Function that chooses the kernels for a shape: a specialized instance if the shape is registered, otherwise the
+/// dynamic one
+const Kernels &select(const Shape &shape);
+
+} // namespace kernels
+
+} // namespace model
+
+#endif
@@ -2,20 +2,103 @@
 #define MODEL_MODEL_H
 
 #include <Eigen/Dense>
+#include <model/Bundle.h>
+#include <model/Embeddings.h>
+#include <model/Half.h>
+#include <model/Kernels.h>
+#include <model/Projection.h>
+#include <model/Quantization.h>
+#include <model/WindowCache.h>
+#include <support/Support/Positions.h>
 #include <support/Support/Support.h>
+#include <support/ThreadPool/ThreadPool.h>
 #include <support/TreeSitter/TreeSitter.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <cmath>
+#include <memory>
+#include <set>
+#include <span>
+#include <unordered_set>
+#include <vector>
 
 namespace model
 {
 
-Eigen::MatrixXf loadMatrix(const std::filesystem::path &filePath, size_t rows, size_t cols);
+using MatrixMap = Eigen::Map<const Eigen::MatrixXf>;
+using VectorMap = Eigen::Map<const Eigen::VectorXf>;
 
-std::unordered_map<std::string, Eigen::VectorXf> loadEmbeddings(const std::filesystem::path &filename);
+/// Function that loads a [rows, cols] column-major matrix
+/// @param dtype - storage type of the file, 16-bit values are widened to fp32
+Eigen::MatrixXf loadMatrix(const std::filesystem::path &filePath, size_t rows, size_t cols,
+                           half::DType dtype = half::DType::Float32);
 
+/// One parsed submission
+struct Document {
+    // path-tokens
+    std::vector<std::string> tokens;
+    // line of each path-token
+    std::vector<size_t> positions;
+};
+
+/// Function that parses one submission into path-tokens
+/// @param filePath - path to the submission
+/// @param lang - language of the submission
+/// @param minLen - minimum number of nodes in a path-token
+Document parseDocument(const std::string &filePath, const std::string &lang, size_t minLen);
+
+/// Function that reads the submissions of a corpus extracted with "positions": true, so they aren't parsed again
+/// @brief - the corpus must be extracted with the options the model uses: root_terminal, masked_identifiers, ids_hash
+/// and the same minimum path-token length
+/// @param dir - output directory of extract with tokens.txt, submissions.txt and positions.bin
+/// @return file name of the submission -> parsed submission
+std::map<std::string, Document> readCorpus(const std::filesystem::path &dir);
+
+/// Embeddings of a batch of submissions gathered once for the models that share an embedding table (see Ensemble)
+struct GatheredBatch {
+    // [numDocs] each submission's [numTokens, embDim] embeddings, they point into packed
+    std::vector<const float *> docs;
+    // the padded sequences packed as ASTCODAModel::predictBatch packs them for kernelSize
+    std::vector<float> packed;
+    // a model with this kernel size convolves packed in place, the others copy the submissions' embeddings
+    size_t kernelSize = 0;
+};
+
+/// Output of the model for one submission
+struct Prediction {
+    // Normalized attention weight ([-1, 1]) of each path-token: the weight of the window that starts at it
+    // [numTokens - kernelSize + 1]
+    Eigen::VectorXf attention;
+    // [numClasses]
+    Eigen::VectorXf logits;
+};
+
+/// Function that chooses "suspicious" lines
+/// @param prediction - output of the model
+/// @param positions - line of each path-token
+/// @param threshold - minimum normalized attention weight of a chosen path-token
+/// @return lines of the chosen path-tokens if the submission belongs to the 2nd class, otherwise {0}
+std::set<size_t> chooseLines(const Prediction &prediction, const std::vector<size_t> &positions, float threshold);
+
+/// Function that guesses the domain of a submission scored against every domain
+/// @brief - a heuristic: the domain whose head is the most confident, i.e. gives its predicted class the largest
+/// softmax probability; the heads are trained separately, so their raw logits aren't comparable, and neither are
+/// these probabilities strictly
+/// @param predictions - [numDomains] output of ASTCODAModel::predictAllDomains
+size_t bestDomain(const std::vector<Prediction> &predictions);
+
+/// Arithmetic of the convolution and the fully-connected layer
+enum class Precision { Float32, Int8 };
+
+/// Model for the detection of AI-generated lines
+/// @brief - inference methods are const and reentrant, so one model can be shared by many threads
 class ASTCODAModel
 {
+    // Documents in a batch are aligned to this number of windows (a multiple of Eigen's GEMM panel width)
+    static constexpr size_t panelWidth = 8;
 
     size_t kernelSize;
     size_t embDim;
@@ -30,44 +113,294 @@ class ASTCODAModel
 
     std::string modelPath;
 
-    // Vocabulary containing embeddings
-    // Each embedding: [embDim]
-    std::unordered_map<std::string, Eigen::VectorXf> embeddings;
+    // Vocabulary containing embeddings, may be shared with other models (see shareEmbeddings)
+    // [numTokens, embDim]
+    std::shared_ptr<const Embeddings> embeddings;
+
+    // Memory the weights below are mapped onto: matrices loaded from a weights directory or a mapped bundle
+    std::shared_ptr<const void> storage;
 
     // Matrix that contains vectors representing domains. Used to compute attention weights
     // [numDomains, numFilters]
-    Eigen::MatrixXf attentionDomains;
-
-    // Batch Normalization
-    // [num_filters]
-    Eigen::MatrixXf batchNormAlpha;
-    // [num_filters]
-    Eigen::MatrixXf batchNormBeta;
-    // [num_filters]
-    Eigen::MatrixXf batchNormMean;
-    // [num_filters]
-    Eigen::MatrixXf batchNormVar;
+    MatrixMap attentionDomains{nullptr, 0, 0};
 
-    // Convolution layer
+    // Convolution layer with the frozen batch normalization folded in
     // [num_filters, emb_dim * kernel_size]
-    Eigen::MatrixXf convMatrix;
+    MatrixMap convMatrix{nullptr, 0, 0};
     // [num_filters]
-    Eigen::MatrixXf convBias;
+    VectorMap convBias{nullptr, 0};
 
     // Fully-connected layer for classification
     // [num_classes * num_domains, num_filters]
-    Eigen::MatrixXf fcMatrix;
-    // [num_classes * num_domains, 1]
-    Eigen::MatrixXf fcBias;
+    MatrixMap fcMatrix{nullptr, 0, 0};
+    // [num_classes * num_domains]
+    VectorMap fcBias{nullptr, 0};
+
+    // Storage type of the embeddings, convMatrix and fcMatrix
+    half::DType dtype = half::DType::Float32;
+    // 16-bit convolution and fully-connected matrices, then convMatrix and fcMatrix are empty and inference widens
+    // these a panel of columns at a time into the calling thread's scratch buffer
+    const uint16_t *convMatrixHalf = nullptr;
+    const uint16_t *fcMatrixHalf = nullptr;
+
+    // fp32 kernels specialized for the model's shape if it is registered
+    const kernels::Kernels *shapeKernels = nullptr;
+
+    Precision precision = Precision::Float32;
+    // Int8 copies of convMatrix and fcMatrix, quantized per output channel when int8 inference is enabled
+    quant::Int8Matrix convMatrixInt8;
+    quant::Int8Matrix fcMatrixInt8;
+    quant::GemvKernel int8Gemv = nullptr;
+
+    // Features (after bias and ReLU) of recently seen windows, fp32 only (int8 activations are scaled per document)
+    std::unique_ptr<WindowCache> windowCache;
+
+    // Per-token projections by each offset of the convolution, fp32 only
+    std::unique_ptr<ProjectionTable> projection;
+    // fp32 copy of a 16-bit convolution matrix for the projection tables (they are much larger anyway)
+    Eigen::MatrixXf projectionConvMatrix;
+
+    // Threads that help the calling one with the windows of a long document (or a large batch)
+    std::unique_ptr<threadpool::ThreadPool> intraOpPool;
+    // threads per call, including the calling one
+    size_t intraOpThreads = 1;
+    // smaller ranges of windows are processed by the calling thread only
+    size_t intraOpMinWindows = 0;
+
+    /// Function that splits a range of windows between the threads of a call
+    /// @return [numChunks + 1] bounds of contiguous chunks aligned to panelWidth, {0, numWindows} if the range is
+    /// below the cutoff or intra-op threads are disabled
+    std::vector<size_t> intraOpChunks(size_t numWindows) const;
+
+    /// Function that runs fn(c) for each chunk c, the calling thread takes the first one
+    void runChunks(const std::vector<size_t> &bounds, const std::function<void(size_t)> &fn) const;
+
+    /// Function that points the weights' maps at their storage
+    void mapWeights(const float *attentionDomainsData, const float *convMatrixData, const float *convBiasData,
+                    const float *fcMatrixData, const float *fcBiasData);
+
+    /// Function that returns the whole fp32 convolution matrix, for bundles, int8 quantization and projection tables
+    /// @param wide - storage a 16-bit matrix is widened into
+    const float *convWeights(Eigen::MatrixXf &wide) const;
+
+    /// Function that returns the whole fp32 fully-connected matrix, see convWeights
+    const float *fcWeights(Eigen::MatrixXf &wide) const;
+
+    /// Function that applies the convolution (without the bias) to consecutive windows of packed embeddings
+    /// @brief - a 16-bit matrix is widened a panel of columns at a time, the products are summed in fp32
+    /// @param packed - embeddings starting at the first window's
+    /// @param features - [numFilters, numWindows] output
+    void convolveWindows(const float *packed, size_t numWindows, float *features) const;
+
+    /// Function that places the documents' windows in a packed batch
+    /// @return [numDocs + 1] offsets of the documents' windows, the last one is the total number of windows
+    std::vector<size_t> windowOffsets(std::span<const Document *const> docs) const;
+
+    /// Function that packs the padded sequences of a batch: [pad][doc 0][pad][doc 1][pad]...[doc n - 1][pad]
+    /// @param gathered - if not null, the documents' embeddings are copied from it instead of looked up
+    /// @param dst - [embDim * (winOffsets.back() + kernelSize - 1)] output
+    void pack(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+              const GatheredBatch *gathered, float *dst) const;
+
+    /// Function that applies the convolution (without the bias) to all the windows of a packed batch
+    /// @brief - with the window cache the bias and ReLU are applied as well, see cachesWindows
+    /// @param gathered - if not null, the embeddings gathered by a model sharing the table (see gatherBatch)
+    /// @return [numFilters, winOffsets.back()] features in the calling thread's scratch buffer (valid until its next
+    /// call)
+    Eigen::Map<Eigen::MatrixXf> convolve(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                                         const GatheredBatch *gathered = nullptr) const;
+
+    /// Whether convolve() takes the features from the window cache, they are activated already then
+    bool cachesWindows() const;
+
+    /// Function that fills the features of a packed batch from the window cache and computes the missed windows
+    /// @brief - the features have the bias and ReLU applied, so a hit skips all of the window's convolution
+    /// @param allEmb - packed embeddings of the batch
+    /// @param features - [numFilters, winOffsets.back()] output, only the documents' windows are written
+    void convolveCached(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                        const float *allEmb, float *features) const;
+
+    /// Function that computes the features of a packed batch as sums of the path-tokens' projections
+    /// @param features - [numFilters, winOffsets.back()] output, only the documents' windows are written
+    void convolveProjected(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                           float *features) const;
+
+    /// Function that applies all the fully-connected heads to each column
+    /// @param pooled - [numFilters, numCols] representations
+    /// @return [numClasses * numDomains, numCols] logits
+    Eigen::MatrixXf fullyConnected(const Eigen::MatrixXf &pooled) const;
 
   public:
+    /// Load a model from a weights directory
+    /// @param vocabulary - if not empty, only the embeddings of these path-tokens are loaded (see loadEmbeddings), so
+    /// memory scales with the corpus rather than with the training vocabulary
+    /// @param dtype - storage type of embeddings.bin, conv_matrix.bin and fc_matrices.bin (the other files are fp32).
+    /// 16-bit weights stay 16-bit in memory (the convolution matrix with Batch Normalization folded in is rounded
+    /// again) and are widened when used, arithmetic is fp32
     ASTCODAModel(const std::string &modelPath, size_t kernelSize, size_t embDim, size_t numFilters, size_t numLabels,
-                 size_t numClasses, const std::string &lang, size_t minLen, float threshold, size_t paddingIdx = 0);
+                 size_t numClasses, const std::string &lang, size_t minLen, float threshold, size_t paddingIdx = 0,
+                 const std::unordered_set<std::string> &vocabulary = {},
+                 half::DType dtype = half::DType::Float32);
+
+    /// Load a model from a bundle (see model::bundle)
+    /// @brief - the bundle is memory-mapped, weights aren't copied
+    /// @param bundlePath - path to the bundle
+    /// @param verify - verify the checksums of all the sections
+    ASTCODAModel(const std::filesystem::path &bundlePath, const std::string &lang, size_t minLen, float threshold,
+                 bool verify = false);
+
+    /// Whether the fp32 kernels are specialized for the model's shape (see kernels::select)
+    bool
+    hasSpecializedKernels() const
+    {
+        return shapeKernels->specialized();
+    }
+
+    size_t
+    getNumDomains() const
+    {
+        return numDomains;
+    }
+
+    size_t
+    getEmbDim() const
+    {
+        return embDim;
+    }
+
+    const std::string &
+    getLang() const
+    {
+        return lang;
+    }
+
+    size_t
+    getMinLen() const
+    {
+        return minLen;
+    }
+
+    float
+    getThreshold() const
+    {
+        return threshold;
+    }
+
+    /// Function that makes the model use the embedding table of another model if both tables are equal
+    /// @brief - the model's own table is released, so models trained with the same embeddings keep one copy
+    /// @brief - unlike inference, this modifies the model: don't call it while other threads run it
+    /// @return whether the table is shared
+    bool shareEmbeddings(const ASTCODAModel &other);
+
+    /// Whether both models use the same embedding table, then the embeddings gathered by one of them can be passed
+    /// to the other (see predictBatch)
+    bool
+    sharesEmbeddings(const ASTCODAModel &other) const
+    {
+        return embeddings == other.embeddings;
+    }
+
+    /// Whether predictBatch reads the embeddings, the fp32 projection tables replace them (see setProjection)
+    bool usesEmbeddings() const;
+
+    /// Function that gathers the embeddings of a batch's path-tokens, unknown ones are mapped to "@@UNK@@"
+    /// @brief - they are packed for this model's kernel size, so it convolves them in place
+    GatheredBatch gatherBatch(std::span<const Document *const> docs) const;
+
+    /// Storage type of the weights (see the weights directory constructor)
+    half::DType
+    getDType() const
+    {
+        return dtype;
+    }
+
+    /// Function that writes the model to a bundle
+    /// @brief - bundles store fp32 weights, 16-bit ones are widened
+    /// @param bundlePath - path to the output bundle
+    void save(const std::filesystem::path &bundlePath) const;
+
+    /// Function that switches between fp32 and int8 inference
+    /// @brief - int8: weights are quantized per output channel, activations are quantized dynamically per document
+    /// @param precision - arithmetic of the convolution and the fully-connected layer
+    /// @brief - unlike inference, this modifies the model: don't call it while other threads run it
+    /// @param isa - instruction set of the int8 kernels, the best one supported by the CPU by default
+    void setPrecision(Precision precision, quant::Isa isa = quant::detectIsa());
+
+    /// Function that enables the cache of window convolutions (see WindowCache)
+    /// @brief - only fp32 inference uses the cache, results equal the uncached ones up to rounding
+    /// @brief - unlike inference, this modifies the model: don't call it while other threads run it
+    /// @param capacity - maximum number of cached windows, each takes about 4 * (kernelSize + numFilters) bytes; 0
+    /// disables the cache
+    void setWindowCache(size_t capacity);
+
+    /// Function that reports the usage of the window cache
+    /// @return zeros if the cache is disabled
+    WindowCache::Stats windowCacheStats() const;
+
+    /// Function that chooses how the fp32 convolution is computed (see ProjectionTable)
+    /// @brief - with projection tables the window cache isn't used: a window already costs kernelSize additions
+    /// @brief - Full takes 4 * kernelSize * numFilters bytes for every path-token of the vocabulary, Lazy only for
+    /// the path-tokens that have been seen; results equal the ones of Off up to rounding
+    /// @brief - unlike inference, this modifies the model: don't call it while other threads run it
+    void setProjection(ProjectionMode mode);
+
+    /// Function that lets one inference call use several threads
+    /// @brief - the convolution (dense fp32 or int8) and the attention pooling of a document are split into
+    /// contiguous ranges of windows; results equal the single-threaded ones up to rounding
+    /// @brief - unlike inference, this modifies the model: don't call it while other threads run it
+    /// @param numThreads - threads per call, including the calling one; 1 disables intra-op threads
+    /// @param minWindows - documents (and batches) with fewer windows are processed by the calling thread only
+    void setIntraOpThreads(size_t numThreads, size_t minWindows = 1024);
+
+    /// Function that reports the size of the projection tables
+    /// @return zeros if the tables are disabled
+    ProjectionTable::Stats projectionStats() const;
+
+    /// Function that parses one submission into path-tokens
+    /// @param filePath - path to the submission
+    Document parse(const std::string &filePath) const;
+
+    /// Function that parses the source code of one submission into path-tokens
+    /// @param source - program code
+    Document parseSource(const std::string &source) const;
+
+    /// Function that runs the model over a batch of parsed submissions
+    /// @brief - padded sequences are packed into one buffer, so the convolution is a single GEMM over the batch
+    /// @brief - the buffer holds about embDim * (sum of lengths + numDocs * (kernelSize - 1 + panelWidth)) floats
+    /// @param docs - parsed submissions
+    /// @param domainIdx - domain which each submission belongs to
+    /// @param gathered - if not null, the embeddings of the batch gathered by this model or by one that shares its
+    /// table (see gatherBatch)
+    std::vector<Prediction> predictBatch(std::span<const Document *const> docs, std::span<const size_t> domainIdx,
+                                         const GatheredBatch *gathered = nullptr) const;
+
+    /// Function that runs the model over one parsed submission
+    /// @param doc - parsed submission
+    /// @param domainIdx - domain which the submission belongs to
+    Prediction predict(const Document &doc, size_t domainIdx) const;
+
+    /// Function that runs the model over one parsed submission for every domain
+    /// @brief - the convolution is computed once, attention and the heads of all the domains are matrix products
+    /// @brief - the d'th prediction equals predict(doc, d) up to rounding
+    /// @param doc - parsed submission
+    /// @return [numDomains] predictions
+    std::vector<Prediction> predictAllDomains(const Document &doc) const;
 
     /// Function that processes one submission
     /// @param filePath - path to the submission
     /// @param domainIdx - domain which the submission belongs to
-    std::set<size_t> run(const std::string &filePath, size_t domainIdx);
+    std::set<size_t> run(const std::string &filePath, size_t domainIdx) const;
+
+    /// Function that processes one submission whose domain is unknown
+    /// @param filePath - path to the submission
+    /// @return [numDomains] chosen lines for each domain
+    std::vector<std::set<size_t>> runAllDomains(const std::string &filePath) const;
+
+    /// Function that processes a batch of parsed submissions, results are the same as of run() for each one
+    /// @param docs - parsed submissions
+    /// @param domainIdx - domain which each submission belongs to
+    std::vector<std::set<size_t>> runBatch(const std::vector<Document> &docs,
+                                           const std::vector<size_t> &domainIdx) const;
 };
 
 } // namespace model
@@ -0,0 +1,64 @@
+#ifndef MODEL_PRODUCTQUANTIZATION_H
+#define MODEL_PRODUCTQUANTIZATION_H
+
+#include <model/Embeddings.h>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <unordered_set>
+
+namespace model
+{
+
+/// Product quantization of embedding tables
+/// @brief - file: [Header][float centroids[numSubspaces * numCentroids * embDim / numSubspaces]][Token 0]...
+/// [Token numTokens - 1], all values are little-endian
+/// @brief - token: [uint32 length][path-token][uint8 codes[numSubspaces]]
+namespace pq
+{
+
+constexpr char magic[8] = {'A', 'S', 'T', 'C', 'O', 'D', 'A', 'Q'};
+constexpr uint32_t version = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t numTokens;
+    uint64_t embDim;
+    uint64_t numSubspaces;
+    uint64_t numCentroids;
+};
+
+static_assert(sizeof(Header) == 48, "The file layout must not depend on the compiler");
+// values are written and read in native order
+static_assert(std::endian::native == std::endian::little, "Product-quantized embeddings are little-endian");
+
+/// Function that learns the codebooks of a table with k-means in each subspace
+/// @param numSubspaces - number of sub-vectors, must divide embDim
+/// @param numCentroids - centroids per subspace, at most 256
+/// @param iterations - k-means iterations
+/// @param sampleSize - number of rows the codebooks are learned on (all the rows if the table is smaller)
+/// @param seed - seed of the sampling and of the initial centroids
+PqCodebook train(const Embeddings &embeddings, size_t numSubspaces, size_t numCentroids, size_t iterations,
+                 size_t sampleSize, uint64_t seed = 0);
+
+/// Function that replaces each sub-vector by its nearest centroid
+/// @return product-quantized table with the same path-tokens
+Embeddings encode(const Embeddings &embeddings, PqCodebook codebook);
+
+/// Function that writes a product-quantized table
+void save(const std::filesystem::path &path, const Embeddings &embeddings);
+
+/// Function that checks whether a file is a product-quantized table
+bool isPqFile(const std::filesystem::path &path);
+
+/// Function that reads a product-quantized table
+/// @param vocabulary - if not empty, only the codes of these path-tokens (and "@@UNK@@") are kept
+Embeddings load(const std::filesystem::path &path, const std::unordered_set<std::string> &vocabulary = {});
+
+} // namespace pq
+
+} // namespace model
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MODEL_PROJECTION_H
+#define MODEL_PROJECTION_H
+
+#include <model/Embeddings.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace model
+{
+
+/// How the fp32 convolution is computed
+/// @brief - Off: one product of the convolution matrix with all the windows
+/// @brief - Lazy: projection tables of the path-tokens are computed the first time they are seen
+/// @brief - Full: projection tables of the whole vocabulary are computed when they are enabled
+enum class ProjectionMode { Off, Lazy, Full };
+
+/// Projections of embeddings by each offset of the convolution
+/// @brief - the convolution is linear in each embedding, so the output of a window is the sum over offsets k of
+/// W_k * e[token_{t + k}], where W_k = convMatrix[:, k * embDim, (k + 1) * embDim). The table stores W_k * e for
+/// every offset of a path-token, so a window costs kernelSize vector additions instead of a matrix-vector product
+/// @brief - a path-token takes 4 * kernelSize * numFilters bytes, rows are allocated in blocks of blockRows
+/// @brief - lookups are thread-safe, projecting missing rows takes a lock
+class ProjectionTable
+{
+  public:
+    static constexpr size_t blockRows = 1024;
+
+    struct Stats {
+        // number of projected path-tokens
+        size_t tokens = 0;
+        // memory taken by the table
+        size_t bytes = 0;
+    };
+
+  private:
+    size_t embDim;
+    size_t kernelSize;
+    size_t numFilters;
+
+    // slot + 1 of each embedding row, 0 if the row isn't projected yet
+    std::vector<std::atomic<uint32_t>> slots;
+    // [numBlocks][blockRows][kernelSize][numFilters], allocated on demand
+    std::vector<std::unique_ptr<float[]>> blocks;
+    std::atomic<size_t> numSlots = 0;
+    mutable std::mutex mutex;
+
+    float *
+    slot(size_t s) const
+    {
+        return blocks[s / blockRows].get() + s % blockRows * kernelSize * numFilters;
+    }
+
+  public:
+    /// @param numTokens - number of rows of the embedding table
+    ProjectionTable(size_t numTokens, size_t embDim, size_t kernelSize, size_t numFilters);
+
+    /// Function that projects every row of the embedding table
+    /// @param convMatrix - [numFilters, embDim * kernelSize] convolution matrix
+    void projectAll(const Embeddings &embeddings, const float *convMatrix);
+
+    /// Function that finds the projections of embedding rows, projecting the rows that aren't in the table yet
+    /// @param rows - embedding rows
+    /// @param projections - [rows.size()] output, the [kernelSize, numFilters] projections of each row (row-major)
+    /// @param convMatrix - [numFilters, embDim * kernelSize] convolution matrix
+    void lookup(std::span<const uint32_t> rows, const float **projections, const Embeddings &embeddings,
+                const float *convMatrix);
+
+    Stats stats() const;
+};
+
+} // namespace model
+
+#endif
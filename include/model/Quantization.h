@@ -0,0 +1,71 @@
+#ifndef MODEL_QUANTIZATION_H
+#define MODEL_QUANTIZATION_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace model
+{
+
+/// Int8 inference helpers
+/// @brief - weights are quantized symmetrically per output channel (row)
+/// @brief - activations are quantized symmetrically per tensor at run time
+/// @brief - dot products are accumulated in int32 by AVX-512 VNNI, AVX2 or scalar kernels chosen at run time
+namespace quant
+{
+
+/// Rows are padded with zeros to a multiple of this number of elements
+constexpr size_t rowAlignment = 64;
+
+/// Row-major int8 matrix: m(r, c) ~ scales[r] * data[r * stride + c]
+struct Int8Matrix {
+    size_t rows = 0;
+    size_t cols = 0;
+    // cols rounded up to rowAlignment
+    size_t stride = 0;
+    // [rows, stride]
+    std::vector<int8_t> data;
+    // [rows]
+    std::vector<float> scales;
+    // [rows], sums of each row's quantized values (used by the kernels working with unsigned activations)
+    std::vector<int32_t> rowSums;
+
+    bool
+    empty() const
+    {
+        return rows == 0;
+    }
+};
+
+/// Function that quantizes a matrix per row
+/// @param m - [rows, cols] float matrix
+Int8Matrix quantizeRows(const Eigen::Ref<const Eigen::MatrixXf> &m);
+
+/// Function that quantizes a vector symmetrically into [-127, 127]
+/// @param src - [n] floats
+/// @param n - number of elements
+/// @param dst - [n] output
+/// @return scale: src[i] ~ scale * dst[i]
+float quantize(const float *src, size_t n, int8_t *dst);
+
+/// out[r] = sum_c m.data[r * stride + c] * a[c] for all rows
+/// @brief - a must have at least m.stride readable elements
+using GemvKernel = void (*)(const Int8Matrix &m, const int8_t *a, int32_t *out);
+
+enum class Isa { Scalar, Avx2, Avx512Vnni };
+
+/// Function that finds the best instruction set supported by the CPU
+Isa detectIsa();
+
+/// Function that returns the kernel for the given instruction set
+GemvKernel gemvKernel(Isa isa);
+
+std::string isaName(Isa isa);
+
+} // namespace quant
+
+} // namespace model
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef MODEL_SCORES_H
+#define MODEL_SCORES_H
+
+#include <model/Model.h>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace model
+{
+
+/// Sidecar with everything chooseLines needs, so the threshold can be tuned without running the model again
+/// @brief - [Header][Record 0]...[Record n - 1], all values are little-endian
+/// @brief - record: [uint32 name length][name][uint32 numClasses][uint64 n][float logits[numClasses]]
+/// [float attention[n]][uint32 positions[n]]
+/// @brief - only the positions of the path-tokens that have an attention weight are stored
+namespace scores
+{
+
+constexpr char magic[8] = {'A', 'S', 'T', 'C', 'O', 'D', 'A', 'S'};
+constexpr uint32_t version = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t numFiles;
+};
+
+static_assert(sizeof(Header) == 24, "The sidecar layout must not depend on the compiler");
+// values are written and read in native order
+static_assert(std::endian::native == std::endian::little, "Scores files are little-endian");
+
+} // namespace scores
+
+/// Scores of one submission
+struct ScoredFile {
+    // file name of the submission
+    std::string name;
+    Prediction prediction;
+    // [prediction.attention.size()] line of each path-token
+    std::vector<size_t> positions;
+};
+
+/// Function that writes a scores sidecar
+/// @param path - output file
+/// @param files - scores of the submissions in the order they are to be listed
+void writeScores(const std::filesystem::path &path, const std::vector<ScoredFile> &files);
+
+/// Function that reads a scores sidecar
+/// @param path - path to the sidecar
+std::vector<ScoredFile> readScores(const std::filesystem::path &path);
+
+} // namespace model
+
+#endif
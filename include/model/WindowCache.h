@@ -0,0 +1,101 @@
+#ifndef MODEL_WINDOWCACHE_H
+#define MODEL_WINDOWCACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace model
+{
+
+/// Bounded LRU cache of the convolution outputs of path-token windows
+/// @brief - a window is identified by the embedding rows of its kernelSize path-tokens (padding has its own id), so a
+/// window repeated across submissions (headers, I/O loops, templates) is convolved once
+/// @brief - the cache is shared by the threads running the model, it is split into shards by window hash, each with
+/// its own lock and LRU order, so that threads looking up different windows rarely wait for each other
+class WindowCache
+{
+  public:
+    /// id of a padding position in a window
+    static constexpr uint32_t paddingId = UINT32_MAX;
+
+    struct Stats {
+        size_t lookups = 0;
+        size_t hits = 0;
+        size_t evictions = 0;
+        // number of cached windows
+        size_t size = 0;
+        size_t capacity = 0;
+        // memory taken by the cached windows and features
+        size_t bytes = 0;
+
+        double
+        hitRate() const
+        {
+            return lookups == 0 ? 0 : double(hits) / lookups;
+        }
+    };
+
+  private:
+    struct Entry {
+        uint64_t hash;
+        // [windowSize]
+        std::vector<uint32_t> window;
+        // [featureSize]
+        std::vector<float> feature;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        size_t capacity = 0;
+        // the most recently used entry is the first one
+        std::list<Entry> entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> byHash;
+        size_t lookups = 0;
+        size_t hits = 0;
+        size_t evictions = 0;
+    };
+
+    static constexpr size_t numShards = 16;
+
+    size_t capacity;
+    size_t windowSize;
+    size_t featureSize;
+    std::array<Shard, numShards> shards;
+
+    static uint64_t hash(const uint32_t *window, size_t windowSize);
+
+    /// @return the shard of a window, chosen by the high bits of its hash (byHash uses the low ones)
+    Shard &
+    shardOf(uint64_t h)
+    {
+        return shards[h >> 60];
+    }
+
+  public:
+    /// @param capacity - maximum number of cached windows, split evenly among the shards
+    /// @param windowSize - number of path-tokens in a window (kernelSize)
+    /// @param featureSize - number of floats in a window's output (numFilters)
+    WindowCache(size_t capacity, size_t windowSize, size_t featureSize);
+
+    /// Function that looks a window up
+    /// @param window - [windowSize] ids of the window's path-tokens
+    /// @param feature - [featureSize] output, written on a hit
+    /// @return whether the window is cached
+    bool find(const uint32_t *window, float *feature);
+
+    /// Function that caches the output of a window, evicting the least recently used one if the cache is full
+    /// @param window - [windowSize] ids of the window's path-tokens
+    /// @param feature - [featureSize] output of the window
+    void insert(const uint32_t *window, const float *feature);
+
+    Stats stats() const;
+};
+
+} // namespace model
+
+#endif
@@ -255,6 +255,8 @@ class Arguments
     std::map<KeyParam, std::unique_ptr<Argument>> parameters;
     // map storing references to Parameters' values (which are in turn represented as std::any)
     std::map<KeyParam, std::any> values;
+    // parameters that may be absent
+    std::set<KeyParam> optional;
 
   protected:
     /// A function to register a new argument rule
@@ -263,16 +265,20 @@ class Arguments
     /// @tparam larg - long argument
     /// @param value - an object of the type @tparam T
     /// @param obj - concrete Argument type (e.g. DirectoryArgument, RangeArgument etc.)
+    /// @param required - if false, the parameter may be absent and then value keeps its initial value
     template <ShortArg sharg, typename T, template <typename> class Object>
         requires((std::is_arithmetic<T>() == true || std::same_as<T, std::string> || IsVector<T>) &&
                  (std::same_as<Object<T>, FileArgument<T>> || std::same_as<Object<T>, DirectoryArgument<T>> ||
                   std::same_as<Object<T>, RangeArgument<T>> || std::same_as<Object<T>, ConstrainedArgument<T>> ||
                   std::same_as<Object<T>, UnconstrainedArgument<T>>) )
     void
-    addParam(T &value, const Object<T> &obj)
+    addParam(T &value, const Object<T> &obj, bool required = true)
     {
         parameters[{sharg.argstr}] = std::make_unique<Object<T>>(obj);
         values[{sharg.argstr}] = &value;
+        if (!required) {
+            optional.insert({sharg.argstr});
+        }
     }
 
   public:
@@ -0,0 +1,51 @@
+#ifndef SUPPORT_SUPPORT_POSITIONS_H
+#define SUPPORT_SUPPORT_POSITIONS_H
+
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <vector>
+
+namespace support
+{
+
+/// Sidecar with the line of each path-token of an extracted corpus, record i belongs to line i of tokens.txt
+/// @brief - [Header][Record 0]...[Record n - 1]
+/// @brief - record: [varint numTokens][varint zigzag(line[j] - line[j - 1])...], line[-1] = 0
+/// @brief - varints are LEB128: 7 bits per byte, low bits first; the lines of consecutive path-tokens are close, so
+/// most of them take one byte
+namespace positions
+{
+
+constexpr char magic[8] = {'A', 'S', 'T', 'C', 'O', 'D', 'A', 'P'};
+constexpr uint32_t version = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t numDocs;
+};
+
+static_assert(sizeof(Header) == 24, "The sidecar layout must not depend on the compiler");
+
+} // namespace positions
+
+/// Function that writes the header of a positions sidecar, the records follow it
+/// @param out - binary output stream
+/// @param numDocs - number of records
+void writePositionsHeader(std::ostream &out, uint64_t numDocs);
+
+/// Function that writes the record of one document
+/// @param out - binary output stream
+/// @param positions - line of each path-token of the document
+void writePositionsRecord(std::ostream &out, const std::vector<size_t> &positions);
+
+/// Function that reads a positions sidecar
+/// @param path - path to the sidecar
+/// @return [numDocs] line of each path-token
+std::vector<std::vector<size_t>> readPositions(const std::filesystem::path &path);
+
+} // namespace support
+
+#endif
@@ -6,6 +6,8 @@
 #include <random>
 #include <any>
 #include <set>
+#include <map>
+#include <fstream>
 
 namespace support
 {
@@ -16,6 +18,25 @@ namespace support
 /// @return vector<string> tokens
 std::vector<std::string> splitLine(const std::string &line, char delimiter = ' ');
 
+/// Function that reads a vocabulary file (one entry per line)
+/// @param path - path to the file (e.g. domain_to_idx.txt)
+/// @brief - an entry repeated on several lines gets the last line number
+/// @return entry -> its line number
+std::map<std::string, size_t> readIndex(const std::filesystem::path &path);
+
+/// Function that counts the lines of a vocabulary file
+/// @brief - the model has one row per line, so repeated entries are counted, unlike in readIndex(path).size()
+/// @param path - path to the file (e.g. label_to_idx.txt)
+/// @return number of lines
+size_t countLines(const std::filesystem::path &path);
+
+/// Function that maps submissions to their domains
+/// @param path - path to the labels file, each row is <submission>,<domain>_<class>[,...]
+/// @param domain2idx - domain -> index
+/// @return submission -> domain index
+std::map<std::string, size_t> readSubmissionDomains(const std::filesystem::path &path,
+                                                    const std::map<std::string, size_t> &domain2idx);
+
 std::vector<std::filesystem::path> getNRandomFiles(const std::filesystem::path &dir, size_t n);
 
 std::vector<size_t> trainTestValidSplit(size_t trainNumber, size_t validNumber, size_t testNumber);
@@ -0,0 +1,119 @@
+#ifndef SUPPORT_THREADPOOL_BOUNDEDQUEUE_H
+#define SUPPORT_THREADPOOL_BOUNDEDQUEUE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace threadpool
+{
+/// Blocking queue of limited capacity that connects the stages of a pipeline
+/// @brief - push waits while the queue is full, pop waits while it is empty
+/// @brief - after close() pushes fail and pops drain what is left
+template <typename T> class BoundedQueue
+{
+  public:
+    /// Statistics of the queue's usage
+    struct Stats {
+        size_t pushes = 0;
+        // depth right after a push
+        size_t maxDepth = 0;
+        double meanDepth = 0;
+        // how many times a producer waited for a free place
+        size_t fullWaits = 0;
+        // how many times a consumer waited for an element
+        size_t emptyWaits = 0;
+    };
+
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+    /// @return false if the queue is closed, then the value is dropped
+    bool
+    push(T &&value)
+    {
+        std::unique_lock lk(m);
+        if (q.size() >= capacity && !closed) {
+            ++fullWaits;
+            notFull.wait(lk, [&] { return q.size() < capacity || closed; });
+        }
+        if (closed) {
+            return false;
+        }
+        q.push_back(std::move(value));
+        ++pushes;
+        maxDepth = std::max(maxDepth, q.size());
+        sumDepth += q.size();
+        lk.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /// @return nullopt if the queue is closed and drained
+    std::optional<T>
+    pop()
+    {
+        auto batch = popBatch(1);
+        if (batch.empty()) {
+            return std::nullopt;
+        }
+        return std::move(batch.front());
+    }
+
+    /// Function that waits for an element and takes up to maxBatch of the ones available
+    /// @return empty if the queue is closed and drained
+    std::vector<T>
+    popBatch(size_t maxBatch)
+    {
+        std::unique_lock lk(m);
+        if (q.empty() && !closed) {
+            ++emptyWaits;
+            notEmpty.wait(lk, [&] { return !q.empty() || closed; });
+        }
+        std::vector<T> batch;
+        while (!q.empty() && batch.size() < maxBatch) {
+            batch.push_back(std::move(q.front()));
+            q.pop_front();
+        }
+        lk.unlock();
+        notFull.notify_all();
+        return batch;
+    }
+
+    void
+    close()
+    {
+        {
+            std::lock_guard lk(m);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    Stats
+    stats() const
+    {
+        std::lock_guard lk(m);
+        return {pushes, maxDepth, pushes == 0 ? 0 : double(sumDepth) / pushes, fullWaits, emptyWaits};
+    }
+
+  private:
+    size_t capacity;
+    std::deque<T> q{};
+    bool closed = false;
+    mutable std::mutex m{};
+    std::condition_variable notFull{};
+    std::condition_variable notEmpty{};
+
+    size_t pushes = 0;
+    size_t maxDepth = 0;
+    size_t sumDepth = 0;
+    size_t fullWaits = 0;
+    size_t emptyWaits = 0;
+};
+}; // namespace threadpool
+
+#endif
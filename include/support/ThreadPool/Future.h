@@ -0,0 +1,203 @@
+#ifndef SUPPORT_THREADPOOL_FUTURE_H
+#define SUPPORT_THREADPOOL_FUTURE_H
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace threadpool
+{
+class ThreadPool;
+
+template <typename T> class Future;
+
+namespace detail
+{
+/// Function that queues a job on the pool, from a worker of the pool or from outside
+void post(ThreadPool &pool, std::move_only_function<void()> job);
+
+/// State shared by a task and its Future
+template <typename T> struct FutureState {
+    using Stored = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    // the pool that runs the continuations
+    ThreadPool *pool;
+    std::mutex m;
+    std::optional<Stored> value;
+    std::exception_ptr error;
+    // called once the result is set
+    std::vector<std::move_only_function<void()>> continuations;
+    std::atomic_bool ready = false;
+
+    explicit FutureState(ThreadPool *pool) : pool(pool) {}
+
+    /// Function that calls func and stores its result or its exception
+    template <typename Func>
+    void
+    run(Func &&func)
+    {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                func();
+                finish([&] { value.emplace(); });
+            } else {
+                finish([&, result = func()]() mutable { value.emplace(std::move(result)); });
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+    }
+
+    void
+    fail(std::exception_ptr e)
+    {
+        finish([&] { error = std::move(e); });
+    }
+
+    /// Function that calls continuation once the result is set, at once if it already is
+    void
+    onReady(std::move_only_function<void()> continuation)
+    {
+        {
+            std::lock_guard lk(m);
+            if (!ready.load(std::memory_order_relaxed)) {
+                continuations.push_back(std::move(continuation));
+                return;
+            }
+        }
+        continuation();
+    }
+
+  private:
+    template <typename Store>
+    void
+    finish(Store &&store)
+    {
+        std::vector<std::move_only_function<void()>> waiting;
+        {
+            std::lock_guard lk(m);
+            store();
+            waiting = std::move(continuations);
+            ready.store(true, std::memory_order_release);
+        }
+        ready.notify_all();
+        for (auto &continuation : waiting) {
+            continuation();
+        }
+    }
+};
+
+/// Result type of a continuation of Future<T>
+template <typename Func, typename T> struct ThenResult {
+    using type = std::invoke_result_t<Func &, T>;
+};
+
+template <typename Func> struct ThenResult<Func, void> {
+    using type = std::invoke_result_t<Func &>;
+};
+} // namespace detail
+
+/// Result of a task of a ThreadPool
+/// @brief - get() returns the task's value or rethrows its exception
+/// @brief - then() runs a function on the result once it is ready, as a new task of the same pool, without blocking
+/// any thread; if the task failed, the function is skipped and the new Future holds the same exception
+/// @brief - as std::future, it has a single consumer: get() or then() is called once, afterwards valid() is false
+template <typename T> class Future
+{
+    std::shared_ptr<detail::FutureState<T>> state;
+
+    template <typename> friend class Future;
+    friend class ThreadPool;
+    friend class TaskGraph;
+
+    explicit Future(std::shared_ptr<detail::FutureState<T>> state) : state(std::move(state)) {}
+
+    /// Function that throws if there's no result to use, either default-constructed or already taken
+    void
+    checkValid() const
+    {
+        if (!state) {
+            throw std::runtime_error("The result of the task has already been taken!");
+        }
+    }
+
+  public:
+    Future() = default;
+
+    bool
+    valid() const
+    {
+        return state != nullptr;
+    }
+
+    /// Whether the result is set
+    bool
+    ready() const
+    {
+        checkValid();
+        return state->ready.load(std::memory_order_acquire);
+    }
+
+    /// Function that blocks until the result is set
+    /// @brief - a worker that waits doesn't run other tasks meanwhile, tasks should chain with then() instead
+    void
+    wait() const
+    {
+        checkValid();
+        state->ready.wait(false, std::memory_order_acquire);
+    }
+
+    /// Function that waits for the result and takes it
+    T
+    get()
+    {
+        wait();
+        auto s = std::move(state);
+        if (s->error) {
+            std::rethrow_exception(s->error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(*s->value);
+        }
+    }
+
+    /// Function that schedules func(value), or func() for Future<void>, after this task
+    /// @return the result of func
+    template <typename Func>
+    Future<typename detail::ThenResult<Func, T>::type>
+    then(Func func)
+    {
+        using Result = typename detail::ThenResult<Func, T>::type;
+        checkValid();
+        auto prev = std::move(state);
+        auto next = std::make_shared<detail::FutureState<Result>>(prev->pool);
+        auto *p = prev.get();
+        p->onReady([prev = std::move(prev), next, func = std::move(func)]() mutable {
+            if (prev->error) {
+                next->fail(prev->error);
+                return;
+            }
+            auto *pool = next->pool;
+            detail::post(*pool, [prev = std::move(prev), next = std::move(next), func = std::move(func)]() mutable {
+                next->run([&] {
+                    if constexpr (std::is_void_v<T>) {
+                        return func();
+                    } else {
+                        return func(std::move(*prev->value));
+                    }
+                });
+            });
+        });
+        return Future<Result>(std::move(next));
+    }
+};
+}; // namespace threadpool
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SUPPORT_THREADPOOL_TASKGRAPH_H
+#define SUPPORT_THREADPOOL_TASKGRAPH_H
+
+#include <support/ThreadPool/ThreadPool.h>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+namespace threadpool
+{
+
+/// Tasks with dependencies between them (a directed acyclic graph)
+/// @brief - a task runs on the pool as soon as all the tasks it depends on are done, no thread waits for it meanwhile
+/// @brief - a worker that finishes a task runs the first of the tasks this makes ready itself, so a chain of tasks
+/// (read -> parse -> infer -> write) stays on one worker while its data is in the cache, and queues the others
+/// @brief - after a task throws, the tasks that haven't started yet are skipped and the first exception is the result
+/// @brief - data goes from task to task through what their functions capture
+class TaskGraph
+{
+    struct Node {
+        std::move_only_function<void()> func;
+        // tasks that depend on this one
+        std::vector<size_t> successors;
+        size_t numDependencies = 0;
+    };
+
+    // state of one launch
+    struct Launch;
+
+    std::vector<Node> nodes;
+
+    /// Function that runs the i'th task, then the first task that it makes ready, and so on; queues the other ready
+    /// ones
+    void visit(ThreadPool &pool, const std::shared_ptr<Launch> &launch, size_t i);
+
+  public:
+    /// Function that adds a task
+    /// @param func - the task, called once per launch
+    /// @param dependencies - tasks that must be done before this one starts, added earlier
+    /// @return index of the task
+    size_t add(std::move_only_function<void()> func, std::initializer_list<size_t> dependencies = {});
+
+    /// Function that makes the task after depend on the task before
+    void precede(size_t before, size_t after);
+
+    size_t
+    size() const
+    {
+        return nodes.size();
+    }
+
+    /// Function that starts the tasks without dependencies on the pool
+    /// @brief - the graph must stay alive and unchanged until the returned Future is ready
+    /// @brief - throws std::runtime_error if the tasks depend on each other in a cycle
+    /// @return ready when all the tasks are done or skipped, holds the first exception of a task
+    Future<void> launch(ThreadPool &pool);
+
+    /// Function that launches the tasks and waits until they are done, rethrowing the first exception
+    /// @brief - called from outside the pool: a worker waiting here doesn't run the tasks
+    void run(ThreadPool &pool);
+};
+}; // namespace threadpool
+
+#endif
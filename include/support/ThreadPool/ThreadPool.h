@@ -1,88 +1,208 @@
 #ifndef SUPPORT_THREADPOOL_THREADPOOL_H
 #define SUPPORT_THREADPOOL_THREADPOOL_H
 
-#include <support/ThreadPool/ThreadSafeQueue.h>
+#include <support/ThreadPool/Future.h>
+#include <support/ThreadPool/WorkStealingDeque.h>
+#include <algorithm>
 #include <vector>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
-#include <future>
+#include <optional>
+#include <type_traits>
 
 namespace threadpool
 {
 
+/// Pool of workers with work-stealing
+/// @brief - a task added by one of the pool's own tasks goes to the bottom of its worker's lock-free deque: the worker
+/// takes its newest task first (LIFO), idle workers steal the oldest ones (FIFO)
+/// @brief - a task added from outside goes to one of several injection queues, submitters take them in turn, so they
+/// don't contend for a single lock
+/// @brief - a worker without tasks spins for a while, then goes on a stack of idle workers and sleeps in atomic::wait;
+/// an added task wakes the most recently idle worker, unless a spinning one is going to take it anyway; a woken worker
+/// counts as spinning until it has a task, then wakes the next one, so a burst of tasks wakes workers one by one
+/// @brief - parallelFor and parallelMap split a range of indices into chunks that the workers claim one by one, with a
+/// single completion latch for the whole range instead of a task and a future for each index
+/// @brief - addTask returns a Future with the task's value or exception, further tasks can be chained with then()
+/// @brief - the destructor waits until all tasks, including the ones they add, are done
 class ThreadPool
 {
-    // Task package for each thread
-    struct Task {
-        // queue of tasks for each worker
-        ThreadSafeQueue<std::move_only_function<void()>> tasks{};
-        // semaphore to allow only one worker in a critical section
-        std::binary_semaphore semaphore{0};
+  public:
+    /// Statistics of the workers, summed over all of them
+    struct Stats {
+        size_t tasks = 0;
+        // how many times a worker found a task while spinning, without going to sleep
+        size_t spinHits = 0;
+        // how many times a worker went to sleep
+        size_t parks = 0;
+        // how many times an added task woke a sleeping worker
+        size_t wakeups = 0;
+        // time the workers spent without a task, spinning or sleeping
+        double idleSeconds = 0;
+    };
+
+    // pause instructions a worker spins for before it goes to sleep (tens of microseconds)
+    static constexpr size_t defaultSpinRounds = 1024;
+
+  private:
+    using Job = std::move_only_function<void()>;
+
+    // state of one worker, the counters are written by it only
+    struct alignas(64) WorkerState {
+        // set by the one who takes the worker off the idle stack, the worker sleeps until then
+        std::atomic_bool woken = false;
+        std::atomic_size_t tasks = 0;
+        std::atomic_size_t spinHits = 0;
+        std::atomic_size_t parks = 0;
+        std::atomic_int64_t idleNanos = 0;
+        // start of the current idle period in steady_clock nanoseconds, 0 while the worker runs a task
+        std::atomic_int64_t idleSince = 0;
+    };
+
+    // queue of tasks submitted from outside the pool
+    struct alignas(64) InjectionShard {
+        std::mutex m;
+        std::deque<Job *> jobs;
+        // the size of jobs, read without the lock: an empty queue isn't locked by the workers looking for a task
+        std::atomic_size_t queued = 0;
     };
 
     // vector[numThreads] storing threads corresponding to workers
     std::vector<std::jthread> threads;
-    // vector[numThreads] for each worker storing it's Task package, e.g. its own semaphore and tasks queue
-    std::vector<Task> tasks;
-    // vector with workers' ids
-    ThreadSafeQueue<size_t> workers;
-
-    // The counter for tasks waiting in a queue
-    std::atomic_int waitingTasks = 0;
-    // The counter for tasks left for processing in total
-    std::atomic_int totalLeftTasks = 0;
+    // vector[numThreads] deque of each worker
+    std::vector<WorkStealingDeque<Job *>> deques;
+    // vector[numThreads] injection queues
+    std::vector<InjectionShard> shards;
+    // the injection queue of the next external task
+    std::atomic_size_t nextShard = 0;
+    // vector[numThreads] state of each worker
+    std::vector<WorkerState> workerStates;
+    std::atomic_size_t wakeups = 0;
+    size_t spinRounds;
+
+    // The counter for tasks added and not finished yet
+    alignas(64) std::atomic_int64_t unfinished = 0;
+    // Changes with every added task, spinning workers watch it
+    alignas(64) std::atomic_uint32_t epoch = 0;
+    // Sleeping workers, the last one to become idle on top
+    std::mutex idleMutex;
+    std::vector<size_t> idle;
+    // The size of idle, read without the lock: nobody needs to be woken while it is 0
+    std::atomic_size_t sleeping = 0;
+    // The counter for workers spinning on epoch or just woken, they take a new task without being woken
+    std::atomic_int spinning = 0;
     // The flag which signals if threadpool can be stopped
-    std::atomic_bool doneThreads = false;
+    std::atomic_bool stopping = false;
+
+    /// Function that queues a task and wakes a worker
+    void submit(Job *job);
+
+    friend void detail::post(ThreadPool &pool, std::move_only_function<void()> job);
+
+    /// Function that wakes one sleeping worker, if there is any
+    void wakeOne();
+
+    /// Function that puts the i'th worker to sleep until it is woken
+    /// @param seen - epoch before the worker last looked for a task, it doesn't sleep if a task has come since
+    /// @return true if the worker was woken, it is counted in spinning then
+    bool park(size_t i, uint32_t seen);
+
+    /// Function that runs chunk(c) for every c in [0, numChunks) on the workers and waits until all of them are done
+    /// @brief - a worker of this pool that calls it runs chunks itself, so nested calls don't wait for busy workers
+    /// @brief - after the first exception the remaining chunks are skipped, and the exception is rethrown here
+    void forChunks(size_t numChunks, std::move_only_function<void(size_t)> chunk);
+
+    /// Function that finds a task for the i'th worker: its own deque, the injection queues, then the other deques
+    Job *findJob(size_t i);
+
+    /// Function that runs the i'th worker until the pool stops
+    void work(size_t i);
 
   public:
-    explicit ThreadPool(size_t numThreads = 1);
+    /// @param numThreads - number of workers
+    /// @param spinRounds - pause instructions an idle worker spins for before it goes to sleep, 0: sleep at once; a
+    /// machine with a single core never spins, since nobody could add a task meanwhile
+    explicit ThreadPool(size_t numThreads = 1, size_t spinRounds = defaultSpinRounds);
 
     ThreadPool(const ThreadPool &) = delete;
 
     ThreadPool &operator=(const ThreadPool &) = delete;
 
-    template <typename Func, typename... Args>
-    std::future<void>
-    addTask(Func f, Args... args)
+    size_t
+    size() const
     {
-        // define the promise
-        std::promise<void> promise;
-
-        // get the future
-        auto fut = promise.get_future();
-
-        // get worker's idx i from the beginning of the queue
-        auto val = workers.pop();
-        if (!val.has_value()) {
-            return fut;
-        }
+        return threads.size();
+    }
 
-        auto i = val.value();
+    /// Statistics of the workers so far
+    Stats stats() const;
 
-        // move this worker to the queue's back
-        workers.push(size_t(val.value()));
+    /// Function that waits until all tasks, including the ones they add, are done
+    /// @brief - called from outside the pool, while nobody else adds tasks
+    void wait();
 
-        // at the beginning
-        if (totalLeftTasks == 0) {
-            doneThreads.store(false, std::memory_order_release);
+    /// Function that calls fn(i) for every i in [begin, end) on the workers and waits until all calls are done
+    /// @param grain - indices a worker takes at once, 0: about four chunks per worker
+    /// @param fn - called concurrently from several threads; if it throws, the remaining indices may be skipped and
+    /// the first exception is rethrown
+    template <typename Func>
+    void
+    parallelFor(size_t begin, size_t end, size_t grain, Func &&fn)
+    {
+        if (begin >= end) {
+            return;
+        }
+        auto count = end - begin;
+        if (grain == 0) {
+            grain = std::max<size_t>(count / (4 * size()), 1);
         }
+        auto numChunks = (count + grain - 1) / grain;
+        forChunks(numChunks, [&](size_t c) {
+            auto chunkEnd = std::min(begin + (c + 1) * grain, end);
+            for (auto i = begin + c * grain; i < chunkEnd; ++i) {
+                fn(i);
+            }
+        });
+    }
 
-        // increase counters
-        totalLeftTasks.fetch_add(1, std::memory_order_release);
-        waitingTasks.fetch_add(1, std::memory_order_release);
+    /// Function that computes fn(i) for every i in [begin, end) on the workers
+    /// @return results in the order of the indices
+    /// @brief - grain and fn as in parallelFor
+    template <typename Func>
+    auto
+    parallelMap(size_t begin, size_t end, size_t grain, Func &&fn)
+    {
+        using Result = std::invoke_result_t<Func &, size_t>;
+        std::vector<std::optional<Result>> slots(end > begin ? end - begin : 0);
+        parallelFor(begin, end, grain, [&](size_t i) { slots[i - begin].emplace(fn(i)); });
+
+        std::vector<Result> results;
+        results.reserve(slots.size());
+        for (auto &slot : slots) {
+            results.push_back(std::move(*slot));
+        }
+        return results;
+    }
 
-        // add task to the queue
-        tasks[i].tasks.push(
-            std::move([func = std::move(f), ... largs = std::move(args), promise = std::move(promise)]() mutable {
-                func(largs...);
-                promise.set_value();
-            }));
+    /// Function that queues func(args...)
+    /// @return the result of the call, or the exception it throws
+    template <typename Func, typename... Args>
+    Future<std::invoke_result_t<Func &, Args &...>>
+    addTask(Func f, Args... args)
+    {
+        using Result = std::invoke_result_t<Func &, Args &...>;
+        auto state = std::make_shared<detail::FutureState<Result>>(this);
 
-        // release semaphore
-        tasks[i].semaphore.release();
+        submit(new Job([func = std::move(f), ... largs = std::move(args), state]() mutable {
+            state->run([&]() -> Result { return func(largs...); });
+        }));
 
-        return fut;
+        return Future<Result>(std::move(state));
     }
+
     ~ThreadPool();
 };
 }; // namespace threadpool
@@ -0,0 +1,146 @@
+#ifndef SUPPORT_THREADPOOL_WORKSTEALINGDEQUE_H
+#define SUPPORT_THREADPOOL_WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace threadpool
+{
+/// Lock-free work-stealing deque of one worker (Chase and Lev, with the memory orders of Le et al., 2013)
+/// @brief - the owner pushes and pops at the bottom (LIFO), any other thread steals from the top (FIFO)
+/// @brief - the buffer doubles when it is full; the old buffers are kept until the deque is destroyed, because a
+/// thief may still be reading one of them
+template <typename T> class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable_v<T>, "Elements are copied through atomics");
+
+    struct Buffer {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<T>[]> slots;
+
+        explicit Buffer(int64_t capacity) : capacity(capacity), slots(new std::atomic<T>[capacity]) {}
+
+        T
+        get(int64_t i) const
+        {
+            return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void
+        put(int64_t i, T value)
+        {
+            slots[i & (capacity - 1)].store(value, std::memory_order_relaxed);
+        }
+    };
+
+  public:
+    /// @param capacity - initial capacity, rounded up to a power of two
+    explicit WorkStealingDeque(int64_t capacity = 256)
+    {
+        int64_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        buffers.push_back(std::make_unique<Buffer>(size));
+        buffer.store(buffers.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    /// Owner only
+    void
+    push(T value)
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto *a = buffer.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            a = grow(a, t, b);
+        }
+        a->put(b, value);
+        // a release store instead of a release fence and a relaxed store: the same on x86, and visible to TSan
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    /// Owner only
+    /// @return false if the deque is empty
+    bool
+    pop(T &value)
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto *a = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        value = a->get(b);
+        if (t == b) {
+            // the last element, a thief may be taking it as well
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /// Any thread
+    /// @return false if the deque is empty
+    bool
+    steal(T &value)
+    {
+        while (true) {
+            auto t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+            value = buffer.load(std::memory_order_acquire)->get(t);
+            if (top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return true;
+            }
+            // another thread took this element, try the next one
+        }
+    }
+
+    /// Approximate number of elements
+    size_t
+    size() const
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+  private:
+    Buffer *
+    grow(Buffer *old, int64_t t, int64_t b)
+    {
+        auto bigger = std::make_unique<Buffer>(old->capacity * 2);
+        for (auto i = t; i < b; ++i) {
+            bigger->put(i, old->get(i));
+        }
+        buffers.push_back(std::move(bigger));
+        buffer.store(buffers.back().get(), std::memory_order_release);
+        return buffers.back().get();
+    }
+
+    alignas(64) std::atomic<int64_t> top = 0;
+    alignas(64) std::atomic<int64_t> bottom = 0;
+    std::atomic<Buffer *> buffer;
+    // every buffer the deque has had, only the owner touches it
+    std::vector<std::unique_ptr<Buffer>> buffers;
+};
+}; // namespace threadpool
+
+#endif
@@ -210,6 +210,10 @@ static std::unordered_map<std::string, std::function<std::string(const std::vect
     {{"ids_hash", std::bind(&Split::toBranch, std::placeholders::_1)},
      {"row_cols", std::bind(&Split::toPosition, std::placeholders::_1)}};
 
+/// Tag that selects the Tree constructor taking the source code itself instead of a file name
+struct FromSource {
+};
+
 /// Class that creates a TSTree from a given file and parses the input options to obtain the requested nodes'
 /// representation
 class Tree
@@ -234,6 +238,10 @@ class Tree
     /// Minimum number of nodes that path-token can contain
     size_t minPathtokenLen;
 
+    /// A function that parses src
+    /// @param lang src's language
+    void parse(const std::string &lang);
+
   public:
     /// A vocabulary storing mapping between hashes and the corresponding terminals' names
     std::unordered_map<size_t, std::string> vocab;
@@ -248,6 +256,11 @@ class Tree
     /// @param splitParam split option (the way we construct a path-context from sequence of nodes)
     Tree(const std::string &fileName, const std::string &lang);
 
+    /// Constructor to build a TSTree from source code in memory
+    /// @param source program code
+    /// @param lang source's language
+    Tree(std::string source, const std::string &lang, FromSource);
+
     /// A function that applies the chosen callables to process an inner file in the right way
     /// @return a vector of strings representing one line in the resulting file
     std::vector<std::string> process(const std::string &traversalParam, const std::string &tokenizationParam,
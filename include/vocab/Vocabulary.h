@@ -26,6 +26,8 @@ class Vocabulary
     std::vector<std::string> classes;
     /// hash2terminal
     json terminalMap = json::object();
+    /// Threads that split the path-tokens of a file
+    size_t numThreads;
 
     /// Function that writes a vocabulary to the given file
     /// @param filepath - path to the file where to write the vocabulary
@@ -34,7 +36,9 @@ class Vocabulary
     void printVocab(const std::string &filepath, const json &vocab);
 
   public:
-    Vocabulary(const std::vector<std::string> &classesTemp);
+    /// @param classesTemp - possible classes within a domain
+    /// @param numThreads - threads that split the path-tokens of a file
+    Vocabulary(const std::vector<std::string> &classesTemp, size_t numThreads = 1);
 
     /// Function that appends unique path-tokens from the given file to a dictionary
     /// @param filepath - path to the file with path-tokens (each line is a " " split string)
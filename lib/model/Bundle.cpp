@@ -0,0 +1,152 @@
+#include <model/Bundle.h>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t
+model::bundle::checksum(std::span<const char> bytes, uint64_t seed)
+{
+    uint64_t hash = seed;
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+namespace
+{
+
+uint64_t
+headerChecksum(model::bundle::Header header, std::span<const model::bundle::Section> sections)
+{
+    header.checksum = 0;
+    auto hash = model::bundle::checksum({reinterpret_cast<const char *>(&header), sizeof(header)});
+    return model::bundle::checksum(
+        {reinterpret_cast<const char *>(sections.data()), sections.size() * sizeof(model::bundle::Section)}, hash);
+}
+
+uint64_t
+alignUp(uint64_t offset)
+{
+    return (offset + model::bundle::alignment - 1) / model::bundle::alignment * model::bundle::alignment;
+}
+
+} // namespace
+
+void
+model::bundle::write(const std::filesystem::path &path, Header header, const std::vector<Tensor> &tensors)
+{
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.numSections = tensors.size();
+
+    // lay out the sections
+    std::vector<Section> sections;
+    uint64_t offset = alignUp(sizeof(Header) + tensors.size() * sizeof(Section));
+    for (auto &t : tensors) {
+        sections.push_back({t.id, t.dtype, t.rows, t.cols, offset, t.bytes.size(), checksum(t.bytes)});
+        offset = alignUp(offset + t.bytes.size());
+    }
+    header.checksum = headerChecksum(header, sections);
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create bundle " + path.string());
+    }
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(sections.data()), sections.size() * sizeof(Section));
+
+    const char zeros[alignment] = {};
+    uint64_t pos = sizeof(Header) + sections.size() * sizeof(Section);
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        file.write(zeros, sections[i].offset - pos);
+        file.write(tensors[i].bytes.data(), tensors[i].bytes.size());
+        pos = sections[i].offset + sections[i].size;
+    }
+    file.write(zeros, alignUp(pos) - pos);
+
+    if (!file) {
+        throw std::runtime_error("Failed to write bundle " + path.string());
+    }
+}
+
+model::MappedFile::MappedFile(const std::filesystem::path &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat " + path.string());
+    }
+    length = st.st_size;
+
+    if (length > 0) {
+        void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map " + path.string());
+        }
+        ptr = static_cast<const char *>(addr);
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+model::MappedFile::~MappedFile()
+{
+    if (ptr != nullptr) {
+        munmap(const_cast<char *>(ptr), length);
+    }
+}
+
+model::Bundle::Bundle(const std::filesystem::path &path, bool verify) : file(std::make_shared<MappedFile>(path))
+{
+    if (file->size() < sizeof(bundle::Header)) {
+        throw std::runtime_error(path.string() + " is too small to be a bundle!");
+    }
+
+    head = reinterpret_cast<const bundle::Header *>(file->data());
+    if (std::memcmp(head->magic, bundle::magic, sizeof(bundle::magic)) != 0) {
+        throw std::runtime_error(path.string() + " is not a bundle!");
+    }
+    if (head->version != bundle::version) {
+        throw std::runtime_error("Unsupported bundle version " + std::to_string(head->version) + "!");
+    }
+    if (file->size() < sizeof(bundle::Header) + head->numSections * sizeof(bundle::Section)) {
+        throw std::runtime_error("Bundle section table is truncated!");
+    }
+
+    sections = {reinterpret_cast<const bundle::Section *>(file->data() + sizeof(bundle::Header)), head->numSections};
+    if (headerChecksum(*head, sections) != head->checksum) {
+        throw std::runtime_error("Bundle header checksum mismatch!");
+    }
+
+    for (auto &s : sections) {
+        if (s.offset % bundle::alignment != 0 || s.offset + s.size > file->size()) {
+            throw std::runtime_error("Bundle section " + std::to_string(uint32_t(s.id)) + " is out of bounds!");
+        }
+        if (verify && bundle::checksum({file->data() + s.offset, s.size}) != s.checksum) {
+            throw std::runtime_error("Bundle section " + std::to_string(uint32_t(s.id)) + " checksum mismatch!");
+        }
+    }
+}
+
+const model::bundle::Section &
+model::Bundle::section(bundle::SectionId id) const
+{
+    for (auto &s : sections) {
+        if (s.id == id) {
+            return s;
+        }
+    }
+    throw std::runtime_error("There's no section " + std::to_string(uint32_t(id)) + " in the bundle!");
+}
@@ -0,0 +1,284 @@
+#include <model/Embeddings.h>
+#include <model/Bundle.h>
+#include <model/ProductQuantization.h>
+#include <support/ThreadPool/ThreadPool.h>
+#include <algorithm>
+#include <cstring>
+
+uint64_t
+model::hashToken(std::string_view token)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : token) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+model::TokenIndex::TokenIndex(const std::vector<std::string> &tokens)
+{
+    ownOffsets.reserve(tokens.size() + 1);
+    ownOffsets.push_back(0);
+    for (auto &token : tokens) {
+        ownStrings.insert(ownStrings.end(), token.begin(), token.end());
+        ownOffsets.push_back(ownStrings.size());
+    }
+
+    // keep the load factor <= 0.5
+    size_t numSlots = 1;
+    while (numSlots < 2 * tokens.size()) {
+        numSlots <<= 1;
+    }
+    ownSlots.assign(numSlots, 0);
+
+    // a token that occurs more than once maps to its last row, as a map filled in order would
+    for (size_t row = 0; row < tokens.size(); ++row) {
+        auto slot = hashToken(tokens[row]) & (numSlots - 1);
+        while (ownSlots[slot] != 0 && tokens[ownSlots[slot] - 1] != tokens[row]) {
+            slot = (slot + 1) & (numSlots - 1);
+        }
+        ownSlots[slot] = row + 1;
+    }
+
+    offsets = ownOffsets;
+    strings = std::string_view(ownStrings.data(), ownStrings.size());
+    slots = ownSlots;
+}
+
+model::TokenIndex::TokenIndex(std::span<const uint64_t> offsets, std::string_view strings,
+                              std::span<const uint32_t> slots)
+    : offsets(offsets), strings(strings), slots(slots)
+{
+    if (slots.empty() || (slots.size() & (slots.size() - 1)) != 0) {
+        throw std::runtime_error("The number of token slots must be a power of 2!");
+    }
+}
+
+std::optional<size_t>
+model::TokenIndex::find(std::string_view token) const
+{
+    if (slots.empty()) {
+        return std::nullopt;
+    }
+
+    auto mask = slots.size() - 1;
+    for (auto slot = hashToken(token) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        size_t row = slots[slot] - 1;
+        if (this->token(row) == token) {
+            return row;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view
+model::TokenIndex::token(size_t row) const
+{
+    return strings.substr(offsets[row], offsets[row + 1] - offsets[row]);
+}
+
+model::Embeddings::Embeddings(RowMatrixXf vectors, TokenIndex tokenIndex)
+    : ownVectors(std::move(vectors)), index(std::move(tokenIndex))
+{
+    data = ownVectors.data();
+    numTokens = ownVectors.rows();
+    embDim = ownVectors.cols();
+
+    auto unk = index.find("@@UNK@@");
+    if (!unk.has_value()) {
+        throw std::runtime_error("There's no @@UNK@@ token in the embeddings!");
+    }
+    unkIdx = unk.value();
+}
+
+model::Embeddings::Embeddings(std::shared_ptr<const void> storage, const float *data, size_t numTokens,
+                              size_t embDim, TokenIndex tokenIndex)
+    : storage(std::move(storage)), data(data), numTokens(numTokens), embDim(embDim), index(std::move(tokenIndex))
+{
+    auto unk = index.find("@@UNK@@");
+    if (!unk.has_value()) {
+        throw std::runtime_error("There's no @@UNK@@ token in the embeddings!");
+    }
+    unkIdx = unk.value();
+}
+
+model::Embeddings::Embeddings(std::vector<uint8_t> codes, PqCodebook codebook, size_t embDim, TokenIndex tokenIndex)
+    : embDim(embDim), codes(std::move(codes)), codebook(std::move(codebook)), index(std::move(tokenIndex))
+{
+    if (this->codebook.numSubspaces == 0 || embDim % this->codebook.numSubspaces != 0) {
+        throw std::runtime_error("The embedding dimension must be divisible by the number of subspaces!");
+    }
+    numTokens = this->codes.size() / this->codebook.numSubspaces;
+
+    auto unk = index.find("@@UNK@@");
+    if (!unk.has_value()) {
+        throw std::runtime_error("There's no @@UNK@@ token in the embeddings!");
+    }
+    unkIdx = unk.value();
+}
+
+model::Embeddings::Embeddings(std::vector<uint16_t> vectors, half::DType dtype, size_t embDim,
+                              TokenIndex tokenIndex)
+    : embDim(embDim), halfVectors(std::move(vectors)), type(dtype), index(std::move(tokenIndex))
+{
+    if (dtype == half::DType::Float32 || embDim == 0) {
+        throw std::runtime_error("A 16-bit table needs a 16-bit type and a nonzero dimension!");
+    }
+    numTokens = halfVectors.size() / embDim;
+
+    auto unk = index.find("@@UNK@@");
+    if (!unk.has_value()) {
+        throw std::runtime_error("There's no @@UNK@@ token in the embeddings!");
+    }
+    unkIdx = unk.value();
+}
+
+size_t
+model::Embeddings::find(std::string_view token) const
+{
+    return index.find(token).value_or(unkIdx);
+}
+
+bool
+model::Embeddings::sameAs(const Embeddings &other) const
+{
+    if (numTokens != other.numTokens || embDim != other.embDim) {
+        return false;
+    }
+    std::vector<float> row(embDim), otherRow(embDim);
+    for (size_t i = 0; i < numTokens; ++i) {
+        if (index.token(i) != other.index.token(i)) {
+            return false;
+        }
+        decode(i, row.data());
+        other.decode(i, otherRow.data());
+        if (std::memcmp(row.data(), otherRow.data(), embDim * sizeof(float)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+model::Embeddings
+model::loadEmbeddings(const std::filesystem::path &filename, const std::unordered_set<std::string> &vocabulary,
+                      half::DType dtype)
+{
+    if (pq::isPqFile(filename)) {
+        return pq::load(filename, vocabulary);
+    }
+
+    // the whole file is mapped: the word of each record is found in one scan, then the vectors are copied straight
+    // into their rows, in parallel for a large table
+    MappedFile mapped(filename);
+    const char *data = mapped.data();
+    size_t size = mapped.size();
+
+    if (size == 0) {
+        throw std::runtime_error("Failed to read header!");
+    }
+    auto *headerEnd = static_cast<const char *>(std::memchr(data, '\n', size));
+    size_t pos = headerEnd != nullptr ? headerEnd - data + 1 : size;
+
+    std::istringstream header_stream(std::string(data, pos - (headerEnd != nullptr)));
+    size_t vocab_size, dim;
+    if (!(header_stream >> vocab_size >> dim)) {
+        throw std::runtime_error("Invalid header format!");
+    }
+    // 16-bit tables name their type after the sizes
+    std::string typeName;
+    auto fileType = header_stream >> typeName ? half::parseDType(typeName) : half::DType::Float32;
+    if (fileType != dtype) {
+        throw std::runtime_error(filename.string() + " stores " + half::dtypeName(fileType) + " vectors, but " +
+                                 half::dtypeName(dtype) + " ones were requested!");
+    }
+    bool wide = dtype == half::DType::Float32;
+    size_t rowBytes = dim * half::elementSize(dtype);
+
+    // the requested tokens and "@@UNK@@" are kept, one row each unless the file repeats a token
+    bool restricted = !vocabulary.empty();
+    size_t rows = restricted ? std::min(vocab_size, vocabulary.size() + 1) : vocab_size;
+    std::vector<std::string> words;
+    words.reserve(rows);
+    // offset of the vector of each kept row
+    std::vector<size_t> offsets;
+    offsets.reserve(rows);
+
+    for (size_t i = 0; i < vocab_size; ++i) {
+        // a word ends with a space, which is skipped, or with a newline, which is the first byte of the vector
+        size_t begin = pos;
+        while (pos < size && data[pos] != ' ' && data[pos] != '\n') {
+            ++pos;
+        }
+        if (pos == size) {
+            throw std::runtime_error("Error reading word at position " + std::to_string(i));
+        }
+        std::string_view word(data + begin, pos - begin);
+        pos += data[pos] == ' ';
+
+        bool keep = !restricted || vocabulary.contains(std::string(word)) || word == "@@UNK@@";
+        if (size - pos < rowBytes) {
+            throw std::runtime_error("Failed to read vector data for word: " + std::string(word));
+        }
+
+        if (keep) {
+            words.emplace_back(word);
+            offsets.push_back(pos);
+        }
+        pos += rowBytes;
+    }
+
+    RowMatrixXf vectors(wide ? words.size() : 0, dim);
+    std::vector<uint16_t> halfVectors(wide ? 0 : words.size() * dim);
+    auto *dst = wide ? reinterpret_cast<char *>(vectors.data()) : reinterpret_cast<char *>(halfVectors.data());
+    auto copyRow = [&](size_t row) { std::memcpy(dst + row * rowBytes, data + offsets[row], rowBytes); };
+
+    // reading the pages of the file is the slow part, a thread per 64 MiB keeps several reads in flight
+    size_t numThreads = std::clamp<size_t>(words.size() * rowBytes >> 26, 1,
+                                         std::max(std::thread::hardware_concurrency(), 1u));
+    if (numThreads == 1) {
+        for (size_t row = 0; row < words.size(); ++row) {
+            copyRow(row);
+        }
+    } else {
+        threadpool::ThreadPool pool(numThreads);
+        pool.parallelFor(0, words.size(), 0, copyRow);
+    }
+
+    if (!wide) {
+        return Embeddings(std::move(halfVectors), dtype, dim, TokenIndex(words));
+    }
+    return Embeddings(std::move(vectors), TokenIndex(words));
+}
+
+void
+model::saveEmbeddings(const std::filesystem::path &filename, const Embeddings &embeddings, half::DType dtype)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create " + filename.string());
+    }
+
+    file << embeddings.size() << ' ' << embeddings.dim();
+    if (dtype != half::DType::Float32) {
+        file << ' ' << half::dtypeName(dtype);
+    }
+    file << '\n';
+
+    std::vector<float> row(embeddings.dim());
+    std::vector<uint16_t> halfRow(embeddings.dim());
+    for (size_t i = 0; i < embeddings.size(); ++i) {
+        file << embeddings.tokens().token(i) << ' ';
+        embeddings.decode(i, row.data());
+        if (dtype == half::DType::Float32) {
+            file.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(float));
+        } else {
+            half::narrow(dtype, row.data(), row.size(), halfRow.data());
+            file.write(reinterpret_cast<const char *>(halfRow.data()), halfRow.size() * sizeof(uint16_t));
+        }
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + filename.string());
+    }
+}
@@ -0,0 +1,151 @@
+#include <model/Ensemble.h>
+#include <map>
+
+model::Voting
+model::Voting::any()
+{
+    return {{}, 1};
+}
+
+model::Voting
+model::Voting::majority(size_t numModels)
+{
+    return {{}, static_cast<double>(numModels / 2 + 1)};
+}
+
+model::Voting
+model::Voting::all(size_t numModels)
+{
+    return {{}, static_cast<double>(numModels)};
+}
+
+model::Ensemble::Ensemble(std::vector<std::unique_ptr<ASTCODAModel>> ensembleModels, Voting ensembleVoting)
+    : models(std::move(ensembleModels)), voting(std::move(ensembleVoting))
+{
+    if (models.empty()) {
+        throw std::runtime_error("An ensemble needs at least one model!");
+    }
+    if (!voting.weights.empty() && voting.weights.size() != models.size()) {
+        throw std::runtime_error("Voting weights must be given for each model of the ensemble!");
+    }
+    if (voting.quorum <= 0) {
+        throw std::runtime_error("The voting quorum must be positive!");
+    }
+
+    auto &first = *models.front();
+    tableOwner.resize(models.size());
+    for (size_t i = 0; i < models.size(); ++i) {
+        auto &m = *models[i];
+        if (m.getLang() != first.getLang() || m.getMinLen() != first.getMinLen() ||
+            m.getNumDomains() != first.getNumDomains()) {
+            throw std::runtime_error("The models of an ensemble must share the language, the minimum path-token "
+                                     "length and the domains!");
+        }
+
+        // the first model with an equal table owns it
+        tableOwner[i] = i;
+        for (size_t j = 0; j < i; ++j) {
+            if (tableOwner[j] == j && m.getEmbDim() == models[j]->getEmbDim() && m.shareEmbeddings(*models[j])) {
+                tableOwner[i] = j;
+                break;
+            }
+        }
+    }
+}
+
+size_t
+model::Ensemble::numTables() const
+{
+    size_t numTables = 0;
+    for (size_t i = 0; i < models.size(); ++i) {
+        numTables += tableOwner[i] == i;
+    }
+    return numTables;
+}
+
+model::Document
+model::Ensemble::parse(const std::string &filePath) const
+{
+    return models.front()->parse(filePath);
+}
+
+std::vector<std::vector<model::Prediction>>
+model::Ensemble::predictBatch(std::span<const Document *const> docs, std::span<const size_t> domainIdx) const
+{
+    // number of models that read the embeddings of each table, the ones with projection tables don't
+    std::vector<size_t> numReaders(models.size(), 0);
+    for (size_t i = 0; i < models.size(); ++i) {
+        numReaders[tableOwner[i]] += models[i]->usesEmbeddings();
+    }
+
+    // Embeddings of the documents gathered once for each table that several models read, packed by the first of them
+    // [numModels], filled at the indices of the table owners
+    std::vector<GatheredBatch> gathered(models.size());
+    std::vector<std::vector<Prediction>> predictions;
+    for (size_t i = 0; i < models.size(); ++i) {
+        auto owner = tableOwner[i];
+        const GatheredBatch *shared = nullptr;
+        if (models[i]->usesEmbeddings() && numReaders[owner] > 1) {
+            if (gathered[owner].kernelSize == 0) {
+                gathered[owner] = models[i]->gatherBatch(docs);
+            }
+            shared = &gathered[owner];
+        }
+        predictions.push_back(models[i]->predictBatch(docs, domainIdx, shared));
+    }
+    return predictions;
+}
+
+std::set<size_t>
+model::Ensemble::vote(const std::vector<std::set<size_t>> &choices) const
+{
+    // 0 stands for "human-written", it isn't a line
+    std::map<size_t, double> votes;
+    for (size_t i = 0; i < choices.size(); ++i) {
+        auto weight = voting.weights.empty() ? 1.0 : voting.weights[i];
+        for (auto line : choices[i]) {
+            if (line != 0) {
+                votes[line] += weight;
+            }
+        }
+    }
+
+    std::set<size_t> result;
+    for (auto &[line, weight] : votes) {
+        if (weight >= voting.quorum) {
+            result.insert(line);
+        }
+    }
+    if (result.empty()) {
+        result.insert(0);
+    }
+    return result;
+}
+
+std::set<size_t>
+model::Ensemble::run(const std::string &filePath, size_t domainIdx) const
+{
+    std::vector<Document> docs = {parse(filePath)};
+    return runBatch(docs, {domainIdx}).front();
+}
+
+std::vector<std::set<size_t>>
+model::Ensemble::runBatch(const std::vector<Document> &docs, const std::vector<size_t> &domainIdx) const
+{
+    std::vector<const Document *> ptrs;
+    for (auto &doc : docs) {
+        ptrs.push_back(&doc);
+    }
+
+    auto predictions = predictBatch(ptrs, domainIdx);
+
+    std::vector<std::set<size_t>> result;
+    for (size_t j = 0; j < docs.size(); ++j) {
+        std::vector<std::set<size_t>> choices;
+        for (size_t i = 0; i < models.size(); ++i) {
+            choices.push_back(chooseLines(predictions[i][j], docs[j].positions, models[i]->getThreshold()));
+        }
+        result.push_back(vote(choices));
+    }
+    return result;
+}
@@ -0,0 +1,221 @@
+#include <model/Half.h>
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MODEL_HALF_X86
+#include <immintrin.h>
+#endif
+
+size_t
+model::half::elementSize(DType dtype)
+{
+    return dtype == DType::Float32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+std::string
+model::half::dtypeName(DType dtype)
+{
+    switch (dtype) {
+    case DType::Float16:
+        return "fp16";
+    case DType::BFloat16:
+        return "bf16";
+    default:
+        return "fp32";
+    }
+}
+
+model::half::DType
+model::half::parseDType(const std::string &name)
+{
+    for (auto dtype : {DType::Float32, DType::Float16, DType::BFloat16}) {
+        if (dtypeName(dtype) == name) {
+            return dtype;
+        }
+    }
+    throw std::runtime_error("Unknown weight type: " + name);
+}
+
+uint16_t
+model::half::toFloat16(float value)
+{
+    auto bits = std::bit_cast<uint32_t>(value);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    auto abs = bits & 0x7fffffff;
+
+    // infinity or NaN (a NaN stays a NaN)
+    if (abs >= 0x7f800000) {
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0);
+    }
+    // 65520 and above round to infinity
+    if (abs >= 0x477ff000) {
+        return sign | 0x7c00;
+    }
+    // below 2^-14 the result is subnormal: a multiple of 2^-24 (scaling by 2^24 is exact, nearbyint ties to even)
+    if (abs < 0x38800000) {
+        return sign | static_cast<uint16_t>(std::nearbyint(std::bit_cast<float>(abs) * 16777216.0f));
+    }
+    // rebias the exponent (127 -> 15) and round the 23-bit mantissa to 10 bits, a carry moves into the exponent
+    uint32_t h = ((abs >> 23) - 112) << 10 | ((abs >> 13) & 0x3ff);
+    auto rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) {
+        ++h;
+    }
+    return sign | h;
+}
+
+float
+model::half::fromFloat16(uint16_t value)
+{
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    if (exponent == 0) {
+        // zero or subnormal
+        auto magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -magnitude : magnitude;
+    }
+    if (exponent == 0x1f) {
+        return std::bit_cast<float>(sign | 0x7f800000 | mantissa << 13);
+    }
+    return std::bit_cast<float>(sign | (exponent + 112) << 23 | mantissa << 13);
+}
+
+uint16_t
+model::half::toBFloat16(float value)
+{
+    auto bits = std::bit_cast<uint32_t>(value);
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        // keep NaNs quiet, rounding could turn them into infinities
+        return (bits >> 16) | 0x40;
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+
+float
+model::half::fromBFloat16(uint16_t value)
+{
+    return std::bit_cast<float>(uint32_t(value) << 16);
+}
+
+namespace
+{
+
+using model::half::DType;
+
+using WidenKernel = void (*)(DType dtype, const uint16_t *src, size_t n, float *dst);
+
+void
+widenScalar(DType dtype, const uint16_t *src, size_t n, float *dst)
+{
+    if (dtype == DType::Float16) {
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = model::half::fromFloat16(src[i]);
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = model::half::fromBFloat16(src[i]);
+        }
+    }
+}
+
+#ifdef MODEL_HALF_X86
+
+__attribute__((target("avx2,f16c"))) void
+widenF16c(DType dtype, const uint16_t *src, size_t n, float *dst)
+{
+    size_t i = 0;
+    if (dtype == DType::Float16) {
+        for (; i + 8 <= n; i += 8) {
+            __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+        }
+    } else {
+        // bf16 is the upper half of fp32
+        for (; i + 8 <= n; i += 8) {
+            __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16)));
+        }
+    }
+    widenScalar(dtype, src + i, n - i, dst + i);
+}
+
+__attribute__((target("avx512f"))) void
+widenAvx512(DType dtype, const uint16_t *src, size_t n, float *dst)
+{
+    size_t i = 0;
+    if (dtype == DType::Float16) {
+        for (; i + 16 <= n; i += 16) {
+            __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(h));
+        }
+    } else {
+        for (; i + 16 <= n; i += 16) {
+            __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16)));
+        }
+    }
+    widenScalar(dtype, src + i, n - i, dst + i);
+}
+
+#endif
+
+struct WidenChoice {
+    WidenKernel kernel;
+    const char *name;
+};
+
+WidenChoice
+chooseWiden()
+{
+#ifdef MODEL_HALF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {widenAvx512, "avx512"};
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+        return {widenF16c, "f16c"};
+    }
+#endif
+    return {widenScalar, "scalar"};
+}
+
+const WidenChoice &
+widenChoice()
+{
+    static const WidenChoice choice = chooseWiden();
+    return choice;
+}
+
+} // namespace
+
+void
+model::half::widen(DType dtype, const uint16_t *src, size_t n, float *dst)
+{
+    if (dtype == DType::Float32) {
+        throw std::runtime_error("Only 16-bit values can be widened!");
+    }
+    widenChoice().kernel(dtype, src, n, dst);
+}
+
+void
+model::half::narrow(DType dtype, const float *src, size_t n, uint16_t *dst)
+{
+    if (dtype == DType::Float32) {
+        throw std::runtime_error("Only 16-bit values can be narrowed!");
+    }
+    // only done when weights are converted or loaded, so there is no vectorized version
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = dtype == DType::Float16 ? toFloat16(src[i]) : toBFloat16(src[i]);
+    }
+}
+
+std::string
+model::half::widenIsaName()
+{
+    return widenChoice().name;
+}
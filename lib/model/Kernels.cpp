@@ -0,0 +1,124 @@
+#include <model/Kernels.h>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+
+using model::kernels::Shape;
+
+/// Kernels for one shape, Eigen::Dynamic stands for a shape known only at run time
+template <int EmbDim, int KernelSize, int NumFilters> struct ShapeKernels {
+    static constexpr int WindowDim =
+        EmbDim == Eigen::Dynamic || KernelSize == Eigen::Dynamic ? Eigen::Dynamic : EmbDim * KernelSize;
+    // windows overlap: the next one starts embDim floats further
+    static constexpr int WindowStride = EmbDim == Eigen::Dynamic ? Eigen::Dynamic : EmbDim;
+
+    using Embedding = Eigen::Matrix<float, EmbDim, 1>;
+    using Feature = Eigen::Matrix<float, NumFilters, 1>;
+    using ConvMatrix = Eigen::Matrix<float, NumFilters, WindowDim>;
+    using Windows = Eigen::Matrix<float, WindowDim, Eigen::Dynamic>;
+    using Features = Eigen::Matrix<float, NumFilters, Eigen::Dynamic>;
+    using FcMatrix = Eigen::Matrix<float, Eigen::Dynamic, NumFilters>;
+
+    static void
+    gather(const model::Embeddings &embeddings, const std::vector<std::string> &tokens, float *dst)
+    {
+        auto embDim = embeddings.dim();
+        if (!embeddings.dense()) {
+            for (auto &token : tokens) {
+                embeddings.decode(embeddings.find(token), dst);
+                dst += embDim;
+            }
+            return;
+        }
+        for (auto &token : tokens) {
+            auto row = embeddings.row(embeddings.find(token));
+            Eigen::Map<Embedding>(dst, embDim) = Eigen::Map<const Embedding>(row.data(), embDim);
+            dst += embDim;
+        }
+    }
+
+    static void
+    convolve(const float *conv, const float *packed, size_t numWindows, float *features, const Shape &shape)
+    {
+        auto windowDim = shape.embDim * shape.kernelSize;
+        Eigen::Map<const ConvMatrix> convMatrix(conv, shape.numFilters, windowDim);
+        Eigen::Map<const Windows, 0, Eigen::OuterStride<WindowStride>> windows(
+            packed, windowDim, numWindows, Eigen::OuterStride<WindowStride>(shape.embDim));
+        Eigen::Map<Features>(features, shape.numFilters, numWindows).noalias() = convMatrix * windows;
+    }
+
+    static void
+    pool(float *features, size_t numWindows, const float *bias, const float *domain, float *attention, float *pooled,
+         const Shape &shape)
+    {
+        auto numFilters = shape.numFilters;
+        Eigen::Map<const Feature> b(bias, numFilters);
+        Eigen::Map<const Feature> dom(domain, numFilters);
+        Eigen::Map<Feature> result(pooled, numFilters);
+        result.setZero();
+
+        // Softmax is computed online: the running sum is rescaled whenever a new maximum weight appears
+        float maxWeight = -std::numeric_limits<float>::infinity();
+        float sumExp = 0;
+        for (size_t i = 0; i < numWindows; ++i) {
+            Eigen::Map<Feature> feat(features + i * numFilters, numFilters);
+            feat = (feat + b).cwiseMax(0.0f);
+
+            float weight = feat.dot(dom);
+            attention[i] = weight;
+
+            if (weight > maxWeight) {
+                float rescale = std::exp(maxWeight - weight);
+                result *= rescale;
+                sumExp *= rescale;
+                maxWeight = weight;
+            }
+
+            float expWeight = std::exp(weight - maxWeight);
+            result += expWeight * feat;
+            sumExp += expWeight;
+        }
+        result /= sumExp;
+    }
+
+    static void
+    fullyConnected(const float *fc, const float *bias, size_t numOutputs, const float *pooled, float *logits,
+                   const Shape &shape)
+    {
+        Eigen::Map<const FcMatrix> fcMatrix(fc, numOutputs, shape.numFilters);
+        Eigen::Map<Eigen::VectorXf>(logits, numOutputs).noalias() =
+            fcMatrix * Eigen::Map<const Feature>(pooled, shape.numFilters) +
+            Eigen::Map<const Eigen::VectorXf>(bias, numOutputs);
+    }
+
+    static constexpr model::kernels::Kernels
+    make()
+    {
+        auto size = [](int n) { return n == Eigen::Dynamic ? size_t(0) : size_t(n); };
+        return {{size(EmbDim), size(KernelSize), size(NumFilters)}, gather, convolve, pool, fullyConnected};
+    }
+};
+
+// Shapes of the published models (embDim, kernelSize, numFilters), add new ones here
+constexpr model::kernels::Kernels registry[] = {
+    ShapeKernels<384, 15, 128>::make(),
+};
+
+constexpr model::kernels::Kernels dynamicKernels =
+    ShapeKernels<Eigen::Dynamic, Eigen::Dynamic, Eigen::Dynamic>::make();
+
+} // namespace
+
+const model::kernels::Kernels &
+model::kernels::select(const Shape &shape)
+{
+    for (auto &k : registry) {
+        if (k.shape.embDim == shape.embDim && k.shape.kernelSize == shape.kernelSize &&
+            k.shape.numFilters == shape.numFilters) {
+            return k;
+        }
+    }
+    return dynamicKernels;
+}
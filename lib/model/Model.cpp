@@ -1,207 +1,917 @@
 #include <model/Model.h>
 
 Eigen::MatrixXf
-model::loadMatrix(const std::filesystem::path &filePath, size_t rows, size_t cols)
+model::loadMatrix(const std::filesystem::path &filePath, size_t rows, size_t cols, half::DType dtype)
 {
     std::ifstream file(filePath, std::ios::binary);
 
     Eigen::MatrixXf matrix(rows, cols);
-    file.read(reinterpret_cast<char *>(matrix.data()), rows * cols * sizeof(float));
+    std::vector<uint16_t> halfValues(dtype == half::DType::Float32 ? 0 : rows * cols);
+    auto *dst = dtype == half::DType::Float32 ? reinterpret_cast<char *>(matrix.data())
+                                              : reinterpret_cast<char *>(halfValues.data());
+    file.read(dst, rows * cols * half::elementSize(dtype));
 
-    if (file.gcount() != rows * cols * sizeof(float)) {
+    if (file.gcount() != rows * cols * half::elementSize(dtype)) {
         throw std::runtime_error("File size doesn't match expected tensor dimensions!");
     }
 
+    if (dtype != half::DType::Float32) {
+        half::widen(dtype, halfValues.data(), halfValues.size(), matrix.data());
+    }
     return matrix;
 }
 
-std::unordered_map<std::string, Eigen::VectorXf>
-model::loadEmbeddings(const std::filesystem::path &filename)
+namespace
+{
+
+/// Weights loaded from a weights directory
+struct LoadedWeights {
+    Eigen::MatrixXf attentionDomains;
+    Eigen::MatrixXf convMatrix;
+    Eigen::VectorXf convBias;
+    Eigen::MatrixXf fcMatrix;
+    Eigen::VectorXf fcBias;
+    // 16-bit matrices replace convMatrix and fcMatrix
+    std::vector<uint16_t> convMatrixHalf;
+    std::vector<uint16_t> fcMatrixHalf;
+};
+
+template <typename T>
+std::span<const char>
+asBytes(const T *data, size_t size)
 {
-    std::unordered_map<std::string, Eigen::VectorXf> embeddings;
+    return {reinterpret_cast<const char *>(data), size * sizeof(T)};
+}
 
-    std::ifstream file(filename, std::ios::binary);
+} // namespace
+
+void
+model::ASTCODAModel::mapWeights(const float *attentionDomainsData, const float *convMatrixData,
+                                const float *convBiasData, const float *fcMatrixData, const float *fcBiasData)
+{
+    // Eigen::Map has no way to be rebound other than to be constructed anew
+    new (&attentionDomains) MatrixMap(attentionDomainsData, numDomains, numFilters);
+    new (&convMatrix) MatrixMap(convMatrixData, numFilters, embDim * kernelSize);
+    new (&convBias) VectorMap(convBiasData, numFilters);
+    new (&fcMatrix) MatrixMap(fcMatrixData, numClasses * numDomains, numFilters);
+    new (&fcBias) VectorMap(fcBiasData, numClasses * numDomains);
+
+    shapeKernels = &kernels::select({embDim, kernelSize, numFilters});
+}
 
-    std::string header;
-    if (!std::getline(file, header)) {
-        throw std::runtime_error("Failed to read header!");
+model::ASTCODAModel::ASTCODAModel(const std::string &modelPath, size_t kernelSize, size_t embDim, size_t numFilters,
+                                  size_t numLabels, size_t numClasses, const std::string &lang, size_t minLen,
+                                  float threshold, size_t paddingIdx,
+                                  const std::unordered_set<std::string> &vocabulary, half::DType dtype)
+    : kernelSize(kernelSize), embDim(embDim), numFilters(numFilters), numLabels(numLabels), numClasses(numClasses),
+      lang(lang), minLen(minLen), threshold(threshold), paddingIdx(paddingIdx), modelPath(modelPath), dtype(dtype)
+{
+    numDomains = numLabels / numClasses;
+
+    std::filesystem::path weightsFolder = modelPath;
+
+    // load weights
+    auto weights = std::make_shared<LoadedWeights>();
+    embeddings =
+        std::make_shared<const Embeddings>(loadEmbeddings(weightsFolder / "embeddings.bin", vocabulary, dtype));
+    weights->attentionDomains = loadMatrix(weightsFolder / "attention_domains.bin", numDomains, numFilters);
+    weights->convMatrix = loadMatrix(weightsFolder / "conv_matrix.bin", numFilters, embDim * kernelSize, dtype);
+    weights->convBias = loadMatrix(weightsFolder / "conv_bias.bin", numFilters, 1);
+    weights->fcMatrix =
+        loadMatrix(weightsFolder / "fc_matrices.bin", numClasses * numDomains, numFilters, dtype);
+    weights->fcBias = loadMatrix(weightsFolder / "fc_biases.bin", numClasses * numDomains, 1);
+
+    // Batch Normalization is frozen at inference, so fold it into the convolution once:
+    // (W * x + b - mean) / sqrt(var + eps) * alpha + beta = (scale * W) * x + (b - mean) * scale + beta
+    // [numFilters]
+    Eigen::VectorXf batchNormAlpha = loadMatrix(weightsFolder / "bn_alpha.bin", numFilters, 1);
+    Eigen::VectorXf batchNormBeta = loadMatrix(weightsFolder / "bn_beta.bin", numFilters, 1);
+    Eigen::VectorXf batchNormMean = loadMatrix(weightsFolder / "bn_mean.bin", numFilters, 1);
+    Eigen::VectorXf batchNormVar = loadMatrix(weightsFolder / "bn_var.bin", numFilters, 1);
+
+    float eps = 1e-5;
+    Eigen::VectorXf scale = batchNormAlpha.array() / (batchNormVar.array() + eps).sqrt();
+    weights->convMatrix = scale.asDiagonal() * weights->convMatrix;
+    weights->convBias = (weights->convBias - batchNormMean).cwiseProduct(scale) + batchNormBeta;
+
+    if (dtype != half::DType::Float32) {
+        // keep only the 16-bit matrices
+        weights->convMatrixHalf.resize(weights->convMatrix.size());
+        half::narrow(dtype, weights->convMatrix.data(), weights->convMatrix.size(), weights->convMatrixHalf.data());
+        weights->fcMatrixHalf.resize(weights->fcMatrix.size());
+        half::narrow(dtype, weights->fcMatrix.data(), weights->fcMatrix.size(), weights->fcMatrixHalf.data());
+        weights->convMatrix.resize(0, 0);
+        weights->fcMatrix.resize(0, 0);
+        convMatrixHalf = weights->convMatrixHalf.data();
+        fcMatrixHalf = weights->fcMatrixHalf.data();
     }
 
-    std::istringstream header_stream(header);
-    size_t vocab_size, dim;
-    if (!(header_stream >> vocab_size >> dim)) {
-        throw std::runtime_error("Invalid header format!");
+    mapWeights(weights->attentionDomains.data(), weights->convMatrix.data(), weights->convBias.data(),
+               weights->fcMatrix.data(), weights->fcBias.data());
+    storage = std::move(weights);
+}
+
+model::ASTCODAModel::ASTCODAModel(const std::filesystem::path &bundlePath, const std::string &lang, size_t minLen,
+                                  float threshold, bool verify)
+    : lang(lang), minLen(minLen), threshold(threshold), paddingIdx(0), modelPath(bundlePath.string())
+{
+    using bundle::SectionId;
+
+    Bundle b(bundlePath, verify);
+    auto &h = b.header();
+    kernelSize = h.kernelSize;
+    embDim = h.embDim;
+    numFilters = h.numFilters;
+    numClasses = h.numClasses;
+    numDomains = h.numDomains;
+    numLabels = numClasses * numDomains;
+
+    auto offsets = b.get<uint64_t>(SectionId::TokenOffsets, h.numTokens + 1);
+    auto strings = b.get<char>(SectionId::TokenStrings, b.section(SectionId::TokenStrings).rows);
+    auto slots = b.get<uint32_t>(SectionId::TokenSlots, b.section(SectionId::TokenSlots).rows);
+    auto vectors = b.get<float>(SectionId::Embeddings, h.numTokens, embDim);
+    embeddings = std::make_shared<const Embeddings>(b.storage(), vectors.data(), h.numTokens, embDim,
+                                                    TokenIndex(offsets, {strings.data(), strings.size()}, slots));
+
+    mapWeights(b.get<float>(SectionId::AttentionDomains, numDomains, numFilters).data(),
+               b.get<float>(SectionId::ConvMatrix, numFilters, embDim * kernelSize).data(),
+               b.get<float>(SectionId::ConvBias, numFilters).data(),
+               b.get<float>(SectionId::FcMatrix, numClasses * numDomains, numFilters).data(),
+               b.get<float>(SectionId::FcBias, numClasses * numDomains).data());
+    storage = b.storage();
+}
+
+void
+model::ASTCODAModel::save(const std::filesystem::path &bundlePath) const
+{
+    using bundle::DType;
+    using bundle::SectionId;
+
+    if (embeddings->quantized()) {
+        throw std::runtime_error("Bundles store fp32 embeddings, product-quantized ones can't be saved to a bundle!");
     }
 
-    for (size_t i = 0; i < vocab_size; ++i) {
-        std::string word;
-        char c;
-        while (file.get(c) && c != ' ') {
-            if (c == '\n') {
-                file.putback(c);
-                break;
-            }
-            word.push_back(c);
+    // 16-bit weights are widened
+    RowMatrixXf wideEmbeddings;
+    if (!embeddings->dense()) {
+        wideEmbeddings.resize(embeddings->size(), embDim);
+        for (size_t i = 0; i < embeddings->size(); ++i) {
+            embeddings->decode(i, wideEmbeddings.row(i).data());
         }
+    }
+    auto *embeddingsData = embeddings->dense() ? embeddings->vectors().data() : wideEmbeddings.data();
+    Eigen::MatrixXf wideConvMatrix, wideFcMatrix;
+    auto *convMatrixData = convWeights(wideConvMatrix);
+    auto *fcMatrixData = fcWeights(wideFcMatrix);
+
+    bundle::Header header{};
+    header.embDim = embDim;
+    header.kernelSize = kernelSize;
+    header.numFilters = numFilters;
+    header.numClasses = numClasses;
+    header.numDomains = numDomains;
+    header.numTokens = embeddings->size();
+
+    auto &index = embeddings->tokens();
+    auto strings = index.getStrings();
+    bundle::write(
+        bundlePath, header,
+        {{SectionId::Embeddings, DType::Float32, embeddings->size(), embDim,
+          asBytes(embeddingsData, embeddings->size() * embDim)},
+         {SectionId::TokenOffsets, DType::UInt64, index.getOffsets().size(), 1,
+          asBytes(index.getOffsets().data(), index.getOffsets().size())},
+         {SectionId::TokenStrings, DType::Char, strings.size(), 1, asBytes(strings.data(), strings.size())},
+         {SectionId::TokenSlots, DType::UInt32, index.getSlots().size(), 1,
+          asBytes(index.getSlots().data(), index.getSlots().size())},
+         {SectionId::AttentionDomains, DType::Float32, numDomains, numFilters,
+          asBytes(attentionDomains.data(), attentionDomains.size())},
+         {SectionId::ConvMatrix, DType::Float32, numFilters, embDim * kernelSize,
+          asBytes(convMatrixData, numFilters * embDim * kernelSize)},
+         {SectionId::ConvBias, DType::Float32, numFilters, 1, asBytes(convBias.data(), convBias.size())},
+         {SectionId::FcMatrix, DType::Float32, numClasses * numDomains, numFilters,
+          asBytes(fcMatrixData, numClasses * numDomains * numFilters)},
+         {SectionId::FcBias, DType::Float32, numClasses * numDomains, 1, asBytes(fcBias.data(), fcBias.size())}});
+}
 
-        if (file.eof() || file.fail()) {
-            throw std::runtime_error("Error reading word at position " + std::to_string(i));
+void
+model::ASTCODAModel::setPrecision(Precision newPrecision, quant::Isa isa)
+{
+    precision = newPrecision;
+    if (precision == Precision::Int8) {
+        if (convMatrixInt8.empty()) {
+            Eigen::MatrixXf wide;
+            convMatrixInt8 = quant::quantizeRows(MatrixMap(convWeights(wide), numFilters, embDim * kernelSize));
+            fcMatrixInt8 = quant::quantizeRows(MatrixMap(fcWeights(wide), numClasses * numDomains, numFilters));
         }
+        int8Gemv = quant::gemvKernel(isa);
+    }
+}
 
-        std::vector<float> vec(dim);
-        file.read(reinterpret_cast<char *>(vec.data()), dim * sizeof(float));
+void
+model::ASTCODAModel::setWindowCache(size_t capacity)
+{
+    windowCache = capacity == 0 ? nullptr : std::make_unique<WindowCache>(capacity, kernelSize, numFilters);
+}
 
-        if (file.gcount() != static_cast<std::streamsize>(dim * sizeof(float))) {
-            throw std::runtime_error("Failed to read vector data for word: " + word);
-        }
+bool
+model::ASTCODAModel::cachesWindows() const
+{
+    return windowCache && precision == Precision::Float32 && !projection;
+}
 
-        embeddings[word] = Eigen::Map<Eigen::VectorXf>(vec.data(), dim);
+bool
+model::ASTCODAModel::usesEmbeddings() const
+{
+    return !projection || precision != Precision::Float32;
+}
+
+model::WindowCache::Stats
+model::ASTCODAModel::windowCacheStats() const
+{
+    return windowCache ? windowCache->stats() : WindowCache::Stats{};
+}
+
+void
+model::ASTCODAModel::setIntraOpThreads(size_t numThreads, size_t minWindows)
+{
+    intraOpThreads = std::max<size_t>(numThreads, 1);
+    intraOpMinWindows = minWindows;
+    intraOpPool = intraOpThreads == 1 ? nullptr : std::make_unique<threadpool::ThreadPool>(intraOpThreads - 1);
+}
+
+std::vector<size_t>
+model::ASTCODAModel::intraOpChunks(size_t numWindows) const
+{
+    if (!intraOpPool || numWindows < intraOpMinWindows) {
+        return {0, numWindows};
+    }
+    // chunks start at whole GEMM column panels, so they are computed by the same micro-kernels as a single product
+    auto chunk = (numWindows + intraOpThreads - 1) / intraOpThreads;
+    chunk = (chunk + panelWidth - 1) / panelWidth * panelWidth;
+    std::vector<size_t> bounds;
+    for (size_t begin = 0; begin < numWindows; begin += chunk) {
+        bounds.push_back(begin);
     }
+    bounds.push_back(numWindows);
+    return bounds;
+}
 
-    return embeddings;
+void
+model::ASTCODAModel::runChunks(const std::vector<size_t> &bounds, const std::function<void(size_t)> &fn) const
+{
+    auto numChunks = bounds.size() - 1;
+    std::vector<threadpool::Future<void>> done;
+    for (size_t c = 1; c < numChunks; ++c) {
+        done.push_back(intraOpPool->addTask([&fn](size_t c) { fn(c); }, c));
+    }
+    // every chunk is waited for before an exception leaves, the first chunk's exception wins
+    std::exception_ptr error;
+    if (numChunks != 0) {
+        try {
+            fn(0);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    for (auto &d : done) {
+        try {
+            d.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
 }
 
-model::ASTCODAModel::ASTCODAModel(const std::string &modelPath, size_t kernelSize, size_t embDim, size_t numFilters,
-                                  size_t numLabels, size_t numClasses, const std::string &lang, size_t minLen,
-                                  float threshold, size_t paddingIdx)
-    : modelPath(modelPath), kernelSize(kernelSize), embDim(embDim), numFilters(numFilters), numLabels(numLabels),
-      numClasses(numClasses), lang(lang), minLen(minLen), threshold(threshold), paddingIdx(paddingIdx)
+void
+model::ASTCODAModel::setProjection(ProjectionMode mode)
 {
-    numDomains = numLabels / numClasses;
+    if (mode == ProjectionMode::Off) {
+        projection = nullptr;
+        projectionConvMatrix.resize(0, 0);
+        return;
+    }
+    if (convMatrixHalf) {
+        convWeights(projectionConvMatrix);
+    }
+    projection = std::make_unique<ProjectionTable>(embeddings->size(), embDim, kernelSize, numFilters);
+    if (mode == ProjectionMode::Full) {
+        projection->projectAll(*embeddings, convMatrixHalf ? projectionConvMatrix.data() : convMatrix.data());
+    }
+}
 
-    std::filesystem::path weightsFolder = modelPath;
+bool
+model::ASTCODAModel::shareEmbeddings(const ASTCODAModel &other)
+{
+    if (embeddings != other.embeddings && !embeddings->sameAs(*other.embeddings)) {
+        return false;
+    }
+    embeddings = other.embeddings;
+    return true;
+}
 
-    // load weights
-    embeddings = loadEmbeddings(weightsFolder / "embeddings.bin");
-    attentionDomains = loadMatrix(weightsFolder / "attention_domains.bin", numDomains, numFilters);
-    batchNormAlpha = loadMatrix(weightsFolder / "bn_alpha.bin", numFilters, 1);
-    batchNormBeta = loadMatrix(weightsFolder / "bn_beta.bin", numFilters, 1);
-    batchNormMean = loadMatrix(weightsFolder / "bn_mean.bin", numFilters, 1);
-    batchNormVar = loadMatrix(weightsFolder / "bn_var.bin", numFilters, 1);
-    convMatrix = loadMatrix(weightsFolder / "conv_matrix.bin", numFilters, embDim * kernelSize);
-    convBias = loadMatrix(weightsFolder / "conv_bias.bin", numFilters, 1);
-    fcMatrix = loadMatrix(weightsFolder / "fc_matrices.bin", numClasses * numDomains, numFilters);
-    fcBias = loadMatrix(weightsFolder / "fc_biases.bin", numClasses * numDomains, 1);
+model::ProjectionTable::Stats
+model::ASTCODAModel::projectionStats() const
+{
+    return projection ? projection->stats() : ProjectionTable::Stats{};
 }
 
-std::set<size_t>
-model::ASTCODAModel::run(const std::string &filePath, size_t domainIdx)
+model::Document
+model::parseDocument(const std::string &filePath, const std::string &lang, size_t minLen)
 {
     treesitter::Tree t(filePath, lang);
-    auto tokens = t.process("root_terminal", "masked_identifiers", "ids_hash", minLen);
-    auto positions = t.positions;
+    Document doc;
+    doc.tokens = t.process("root_terminal", "masked_identifiers", "ids_hash", minLen);
+    doc.positions = std::move(t.positions);
+    return doc;
+}
+
+std::map<std::string, model::Document>
+model::readCorpus(const std::filesystem::path &dir)
+{
+    auto positions = support::readPositions(dir / "positions.bin");
+    std::ifstream tokensFile(dir / "tokens.txt");
+    std::ifstream submissionsFile(dir / "submissions.txt");
+    if (!tokensFile || !submissionsFile) {
+        throw std::runtime_error("Failed to open tokens.txt or submissions.txt in " + dir.string());
+    }
+
+    std::map<std::string, Document> docs;
+    std::string tokensLine, name;
+    for (auto &docPositions : positions) {
+        if (!std::getline(tokensFile, tokensLine) || !std::getline(submissionsFile, name)) {
+            throw std::runtime_error("positions.bin has more submissions than tokens.txt or submissions.txt in " +
+                                     dir.string());
+        }
+        Document doc;
+        doc.tokens = support::splitLine(tokensLine);
+        if (doc.tokens.size() != docPositions.size()) {
+            throw std::runtime_error("The path-tokens and the positions of " + name + " don't match!");
+        }
+        doc.positions = std::move(docPositions);
+        docs[name] = std::move(doc);
+    }
+    if (std::getline(submissionsFile, name)) {
+        throw std::runtime_error("submissions.txt has more submissions than positions.bin in " + dir.string());
+    }
+    return docs;
+}
 
-    Eigen::VectorXf zeroVec(embDim);
-    zeroVec.setZero();
+model::Document
+model::ASTCODAModel::parse(const std::string &filePath) const
+{
+    return parseDocument(filePath, lang, minLen);
+}
 
-    // Vector that stores concatenated embeddings for each token in the padded token sequence
-    Eigen::VectorXf allEmb(embDim * (tokens.size() + 2 * kernelSize - 2));
+model::Document
+model::ASTCODAModel::parseSource(const std::string &source) const
+{
+    treesitter::Tree t(source, lang, treesitter::FromSource{});
+    Document doc;
+    doc.tokens = t.process("root_terminal", "masked_identifiers", "ids_hash", minLen);
+    doc.positions = std::move(t.positions);
+    return doc;
+}
 
-    // Get embeddings and pad the submission
-    size_t idx = 0;
-    for (size_t i = 0; i < kernelSize - 1; ++i) {
-        allEmb.segment(idx, embDim) = zeroVec;
-        idx += embDim;
+namespace
+{
+
+/// Scratch buffers of one thread
+/// @brief - inference only reads the model, so any number of threads can run it at once; each of them reuses its own
+/// buffers between submissions instead of allocating them anew
+struct Workspace {
+    // packed embeddings of a batch
+    std::vector<float> embeddings;
+    std::vector<int8_t> embeddingsInt8;
+    // convolution features of a batch
+    std::vector<float> features;
+    // embedding rows of a padded document, for the window cache and the projection tables
+    std::vector<uint32_t> ids;
+    // projections of a document's path-tokens
+    std::vector<const float *> projections;
+    // a panel of widened 16-bit weights
+    std::vector<float> weightPanel;
+};
+
+Workspace &
+workspace()
+{
+    thread_local Workspace ws;
+    return ws;
+}
+
+/// Function that grows a buffer to at least the given size
+template <typename T>
+T *
+grow(std::vector<T> &buffer, size_t size)
+{
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+// Number of floats a 16-bit matrix is widened into at a time, the panel stays in the cache while it is multiplied
+constexpr Eigen::Index widenPanelSize = 1 << 14;
+// Windows that go through all the panels before the next ones, their features stay in the cache meanwhile (a
+// multiple of panelWidth, so a window's result doesn't depend on the batch)
+constexpr Eigen::Index widenBlockWindows = 256;
+
+/// Function that runs fn(panel, k) for consecutive panels of columns of a 16-bit column-major matrix
+/// @brief - each panel is widened into the calling thread's scratch buffer right before fn uses it, so the whole
+/// matrix is never widened at once; the panels only depend on the matrix's shape
+/// @param fn - called with the [rows, width] fp32 panel of the columns [k, k + width)
+template <typename Func>
+void
+forWidenedPanels(model::half::DType dtype, const uint16_t *matrix, Eigen::Index rows, Eigen::Index cols, Func fn)
+{
+    auto panelCols = std::max<Eigen::Index>(widenPanelSize / rows, 1);
+    auto *buffer = grow(workspace().weightPanel, rows * std::min(panelCols, cols));
+    for (Eigen::Index k = 0; k < cols; k += panelCols) {
+        auto width = std::min(panelCols, cols - k);
+        model::half::widen(dtype, matrix + k * rows, rows * width, buffer);
+        fn(Eigen::Map<const Eigen::MatrixXf>(buffer, rows, width), k);
     }
+}
+
+/// Function that maps the attention weights of a document's windows to [-1, 1]
+/// @brief - only the windows that end at a path-token and start at a path-token or the left padding are kept: the
+/// i'th of them ends at the (i + kernelSize - 1)'th token and is attributed to the i'th one
+/// @param weights - [numTokens + kernelSize - 1] weights of all the document's windows
+Eigen::VectorXf
+normalizeAttention(const Eigen::Ref<const Eigen::VectorXf> &weights, size_t numTokens, size_t kernelSize)
+{
+    auto maxVal = weights.maxCoeff();
+    auto minVal = weights.minCoeff();
+    auto numKept = numTokens >= kernelSize - 1 ? numTokens - kernelSize + 1 : 0;
+    return -1 + (weights.segment(kernelSize - 1, numKept).array() - minVal) * 2 / (maxVal - minVal);
+}
+
+} // namespace
 
-    for (auto &v : tokens) {
-        // get a pretrained embedding if exists, otherwise initialize it with "UNK"
-        if (embeddings.contains(v)) {
-            allEmb.segment(idx, embDim) = embeddings[v];
+const float *
+model::ASTCODAModel::convWeights(Eigen::MatrixXf &wide) const
+{
+    if (!convMatrixHalf) {
+        return convMatrix.data();
+    }
+    wide.resize(numFilters, embDim * kernelSize);
+    half::widen(dtype, convMatrixHalf, wide.size(), wide.data());
+    return wide.data();
+}
+
+const float *
+model::ASTCODAModel::fcWeights(Eigen::MatrixXf &wide) const
+{
+    if (!fcMatrixHalf) {
+        return fcMatrix.data();
+    }
+    wide.resize(numClasses * numDomains, numFilters);
+    half::widen(dtype, fcMatrixHalf, wide.size(), wide.data());
+    return wide.data();
+}
+
+void
+model::ASTCODAModel::convolveWindows(const float *packed, size_t numWindows, float *features) const
+{
+    if (!convMatrixHalf) {
+        shapeKernels->convolve(convMatrix.data(), packed, numWindows, features, {embDim, kernelSize, numFilters});
+        return;
+    }
+
+    auto windowDim = static_cast<Eigen::Index>(embDim * kernelSize);
+    for (size_t first = 0; first < numWindows; first += widenBlockWindows) {
+        auto count = std::min<Eigen::Index>(widenBlockWindows, numWindows - first);
+        Eigen::Map<const Eigen::MatrixXf, 0, Eigen::OuterStride<>> windows(packed + first * embDim, windowDim, count,
+                                                                           Eigen::OuterStride<>(embDim));
+        Eigen::Map<Eigen::MatrixXf> result(features + first * numFilters, numFilters, count);
+        forWidenedPanels(dtype, convMatrixHalf, numFilters, windowDim, [&](const auto &panel, Eigen::Index k) {
+            if (k == 0) {
+                result.noalias() = panel * windows.middleRows(k, panel.cols());
+            } else {
+                result.noalias() += panel * windows.middleRows(k, panel.cols());
+            }
+        });
+    }
+}
+
+std::vector<size_t>
+model::ASTCODAModel::windowOffsets(std::span<const Document *const> docs) const
+{
+    // The j'th document's windows are [winOffsets[j], winOffsets[j] + numTokens + kernelSize - 1). Each document's
+    // range is rounded up to a whole number of GEMM column panels (extra windows run over zeros and are ignored), so a
+    // document is computed by the same micro-kernels wherever it is in the batch and the result doesn't depend on it
+    std::vector<size_t> winOffsets(docs.size() + 1, 0);
+    for (size_t j = 0; j < docs.size(); ++j) {
+        auto numWindows = docs[j]->tokens.size() + kernelSize - 1;
+        winOffsets[j + 1] = winOffsets[j] + (numWindows + panelWidth - 1) / panelWidth * panelWidth;
+    }
+    return winOffsets;
+}
+
+void
+model::ASTCODAModel::pack(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                          const GatheredBatch *gathered, float *dst) const
+{
+    // The padded sequences are packed one after another, neighbours share their kernelSize - 1 zero vectors
+    auto size = embDim * (winOffsets.back() + kernelSize - 1);
+    size_t idx = 0;
+    for (size_t j = 0; j < docs.size(); ++j) {
+        // zeros between the previous document and this one
+        size_t start = embDim * (winOffsets[j] + kernelSize - 1);
+        std::fill(dst + idx, dst + start, 0.0f);
+        idx = start;
+
+        // Gather the rows of the embedding table, unknown tokens are mapped to "@@UNK@@"
+        if (!gathered) {
+            shapeKernels->gather(*embeddings, docs[j]->tokens, dst + idx);
         } else {
-            allEmb.segment(idx, embDim) = embeddings["@@UNK@@"];
+            std::copy(gathered->docs[j], gathered->docs[j] + embDim * docs[j]->tokens.size(), dst + idx);
         }
-        idx += embDim;
+        idx += embDim * docs[j]->tokens.size();
     }
+    std::fill(dst + idx, dst + size, 0.0f);
+}
 
-    for (size_t i = 0; i < kernelSize - 1; ++i) {
-        allEmb.segment(idx, embDim) = zeroVec;
-        idx += embDim;
+Eigen::Map<Eigen::MatrixXf>
+model::ASTCODAModel::convolve(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                              const GatheredBatch *gathered) const
+{
+    auto &ws = workspace();
+    auto numConvs = winOffsets.back();
+
+    // [numFilters, numConvs]
+    Eigen::Map<Eigen::MatrixXf> features(grow(ws.features, numFilters * numConvs), numFilters, numConvs);
+    if (!usesEmbeddings()) {
+        convolveProjected(docs, winOffsets, features.data());
+        return features;
     }
 
-    // Apply convolution layer
-    auto numConvs = tokens.size() + kernelSize - 1;
-    std::vector<Eigen::VectorXf> features;
-    for (auto i = 0; i < numConvs; ++i) {
-        // [embDim * kernelSize]
-        auto a = allEmb.segment(i * embDim, embDim * kernelSize);
-        // [numFilters]
-        auto v = convMatrix * a + convBias;
-        features.push_back(v);
+    // Concatenated embeddings of the packed token sequence, the ones gathered for this kernel size are already packed
+    // the same way (the layout depends only on the kernel size and the documents)
+    auto allEmbSize = embDim * (numConvs + kernelSize - 1);
+    const float *allEmb = nullptr;
+    if (gathered && gathered->kernelSize == kernelSize) {
+        allEmb = gathered->packed.data();
+    } else {
+        auto *buffer = grow(ws.embeddings, allEmbSize);
+        pack(docs, winOffsets, gathered, buffer);
+        allEmb = buffer;
     }
 
-    // Batch Normalization
-    float eps = 1e-5;
-    for (auto &feat : features) {
-        auto p = (feat.array() - batchNormMean.array()) / (batchNormVar.array() + eps).sqrt();
-        // [numFilters]
-        feat = p.array() * batchNormAlpha.array() + batchNormBeta.array();
+    // Apply convolution layer (with folded Batch Normalization) to all windows at once.
+    // The window starting at the i'th padded token is the contiguous slice allEmb[i * embDim, (i + kernelSize) * embDim),
+    // so the windows form a [embDim * kernelSize, numConvs] matrix with an outer stride of embDim over the same buffer,
+    // and the whole convolution becomes a single GEMM
+    if (precision == Precision::Int8) {
+        // Quantize each document's padded sequence with its own scale (so a document's result doesn't depend on the
+        // batch), then every window is an int8 slice of the same buffer. Windows may read up to the row stride, so
+        // the buffer has some slack (whatever it holds is multiplied by the zero padding of the weights)
+        auto *allEmbInt8 = grow(ws.embeddingsInt8, allEmbSize + convMatrixInt8.stride);
+        Eigen::Map<const Eigen::VectorXf> convScales(convMatrixInt8.scales.data(), numFilters);
+
+        for (size_t j = 0; j < docs.size(); ++j) {
+            auto numWindows = docs[j]->tokens.size() + kernelSize - 1;
+            auto begin = embDim * winOffsets[j];
+            auto scale = quant::quantize(allEmb + begin, embDim * (numWindows + kernelSize - 1), allEmbInt8 + begin);
+
+            auto bounds = intraOpChunks(numWindows);
+            runChunks(bounds, [&](size_t c) {
+                // [numFilters]
+                std::vector<int32_t> acc(numFilters);
+                for (size_t i = winOffsets[j] + bounds[c]; i < winOffsets[j] + bounds[c + 1]; ++i) {
+                    int8Gemv(convMatrixInt8, allEmbInt8 + i * embDim, acc.data());
+                    auto dot = Eigen::Map<const Eigen::VectorXi>(acc.data(), numFilters).cast<float>();
+                    features.col(i) = dot.cwiseProduct(convScales) * scale;
+                }
+            });
+        }
+    } else if (cachesWindows()) {
+        convolveCached(docs, winOffsets, allEmb, features.data());
+    } else {
+        // columns of the product are independent, so long ranges of windows are split between threads
+        auto bounds = intraOpChunks(numConvs);
+        runChunks(bounds, [&](size_t c) {
+            convolveWindows(allEmb + bounds[c] * embDim, bounds[c + 1] - bounds[c],
+                            features.data() + bounds[c] * numFilters);
+        });
     }
+    return features;
+}
 
-    // ReLU
-    for (auto &feat : features) {
-        auto p = feat.array().max(0);
-        // [numFilters]
-        feat = p;
+void
+model::ASTCODAModel::convolveCached(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                                    const float *allEmb, float *features) const
+{
+    auto &ws = workspace();
+
+    for (size_t j = 0; j < docs.size(); ++j) {
+        auto &tokens = docs[j]->tokens;
+        auto numWindows = tokens.size() + kernelSize - 1;
+
+        // Ids of the padded document [pad][doc j][pad], the i'th window is ids[i, i + kernelSize)
+        auto *ids = grow(ws.ids, numWindows + kernelSize - 1);
+        std::fill(ids, ids + numWindows + kernelSize - 1, WindowCache::paddingId);
+        for (size_t t = 0; t < tokens.size(); ++t) {
+            ids[kernelSize - 1 + t] = static_cast<uint32_t>(embeddings->find(tokens[t]));
+        }
+
+        // Missed windows are contiguous in the packed buffer, so each run of them is convolved by one product
+        size_t missBegin = 0;
+        for (size_t i = 0; i <= numWindows; ++i) {
+            if (i < numWindows && !windowCache->find(ids + i, features + (winOffsets[j] + i) * numFilters)) {
+                continue;
+            }
+            if (missBegin < i) {
+                auto first = winOffsets[j] + missBegin;
+                convolveWindows(allEmb + first * embDim, i - missBegin, features + first * numFilters);
+                Eigen::Map<Eigen::MatrixXf> missed(features + first * numFilters, numFilters, i - missBegin);
+                missed = (missed.colwise() + convBias).cwiseMax(0.0f);
+                for (size_t m = missBegin; m < i; ++m) {
+                    windowCache->insert(ids + m, features + (first + m - missBegin) * numFilters);
+                }
+            }
+            missBegin = i + 1;
+        }
     }
+}
 
-    // Get the domain vector
-    // [numFilters]
-    auto dom = attentionDomains.row(domainIdx);
+void
+model::ASTCODAModel::convolveProjected(std::span<const Document *const> docs, const std::vector<size_t> &winOffsets,
+                                       float *features) const
+{
+    auto &ws = workspace();
 
-    Eigen::VectorXf attentionWeights(numConvs);
-    attentionWeights.setZero();
+    for (size_t j = 0; j < docs.size(); ++j) {
+        auto &tokens = docs[j]->tokens;
+        auto *ids = grow(ws.ids, tokens.size());
+        for (size_t t = 0; t < tokens.size(); ++t) {
+            ids[t] = static_cast<uint32_t>(embeddings->find(tokens[t]));
+        }
+        auto *projections = grow(ws.projections, tokens.size());
+        projection->lookup({ids, tokens.size()}, projections, *embeddings,
+                           convMatrixHalf ? projectionConvMatrix.data() : convMatrix.data());
+
+        // The i'th window covers path-tokens [i - kernelSize + 1, i], path-token t is at offset t - i + kernelSize - 1
+        // of it. Padding is zero, so it adds nothing
+        auto numWindows = tokens.size() + kernelSize - 1;
+        for (size_t i = 0; i < numWindows; ++i) {
+            Eigen::Map<Eigen::VectorXf> feature(features + (winOffsets[j] + i) * numFilters, numFilters);
+            feature.setZero();
+            for (size_t t = i < kernelSize - 1 ? 0 : i - kernelSize + 1; t <= i && t < tokens.size(); ++t) {
+                auto k = t + kernelSize - 1 - i;
+                feature += Eigen::Map<const Eigen::VectorXf>(projections[t] + k * numFilters, numFilters);
+            }
+        }
+    }
+}
 
-    float sum = 0;
+Eigen::MatrixXf
+model::ASTCODAModel::fullyConnected(const Eigen::MatrixXf &pooled) const
+{
+    // Logits of all the heads
+    // [numClasses * numDomains, numCols]
+    Eigen::MatrixXf logits(numClasses * numDomains, pooled.cols());
+    if (precision == Precision::Int8) {
+        Eigen::Map<const Eigen::VectorXf> fcScales(fcMatrixInt8.scales.data(), numClasses * numDomains);
+        std::vector<int8_t> pooledInt8(fcMatrixInt8.stride, 0);
+        std::vector<int32_t> acc(numClasses * numDomains);
+        for (Eigen::Index j = 0; j < pooled.cols(); ++j) {
+            auto scale = quant::quantize(pooled.col(j).data(), numFilters, pooledInt8.data());
+            int8Gemv(fcMatrixInt8, pooledInt8.data(), acc.data());
+            auto dot = Eigen::Map<const Eigen::VectorXi>(acc.data(), acc.size()).cast<float>();
+            logits.col(j) = dot.cwiseProduct(fcScales) * scale + fcBias;
+        }
+    } else if (!fcMatrixHalf) {
+        // column by column, so the result for a column doesn't depend on the others
+        for (Eigen::Index j = 0; j < pooled.cols(); ++j) {
+            shapeKernels->fullyConnected(fcMatrix.data(), fcBias.data(), numClasses * numDomains,
+                                         pooled.col(j).data(), logits.col(j).data(), {embDim, kernelSize, numFilters});
+        }
+    } else {
+        // each panel is widened once for all the columns, which are still computed one by one
+        forWidenedPanels(dtype, fcMatrixHalf, numClasses * numDomains, numFilters,
+                         [&](const auto &panel, Eigen::Index k) {
+                             for (Eigen::Index j = 0; j < pooled.cols(); ++j) {
+                                 if (k == 0) {
+                                     logits.col(j).noalias() = panel * pooled.col(j).segment(k, panel.cols());
+                                 } else {
+                                     logits.col(j).noalias() += panel * pooled.col(j).segment(k, panel.cols());
+                                 }
+                             }
+                         });
+        logits.colwise() += fcBias;
+    }
+    return logits;
+}
 
-    // Compute the dot product between the domain vector and the feature and store it as a vector
-    // [numConvs]
-    size_t ind = 0;
-    for (auto &feat : features) {
-        attentionWeights(ind++) = feat.dot(dom);
+model::GatheredBatch
+model::ASTCODAModel::gatherBatch(std::span<const Document *const> docs) const
+{
+    auto winOffsets = windowOffsets(docs);
+    GatheredBatch gathered;
+    gathered.kernelSize = kernelSize;
+    gathered.packed.resize(embDim * (winOffsets.back() + kernelSize - 1));
+    pack(docs, winOffsets, nullptr, gathered.packed.data());
+    for (size_t j = 0; j < docs.size(); ++j) {
+        gathered.docs.push_back(gathered.packed.data() + embDim * (winOffsets[j] + kernelSize - 1));
     }
+    return gathered;
+}
 
-    auto maxVal = attentionWeights.maxCoeff();
-    auto minVal = attentionWeights.minCoeff();
+std::vector<model::Prediction>
+model::ASTCODAModel::predictBatch(std::span<const Document *const> docs, std::span<const size_t> domainIdx,
+                                  const GatheredBatch *gathered) const
+{
+    if (docs.size() != domainIdx.size()) {
+        throw std::runtime_error("Each document in a batch needs a domain!");
+    }
+    if (gathered && gathered->docs.size() != docs.size()) {
+        throw std::runtime_error("Gathered embeddings must be given for each document in a batch!");
+    }
 
-    Eigen::VectorXf attentionWeightsNorm = -1 + (attentionWeights.array() - minVal) * 2 / (maxVal - minVal);
-    std::vector<int> indices;
+    auto winOffsets = windowOffsets(docs);
+    // [numFilters, numConvs]
+    auto features = convolve(docs, winOffsets, gathered);
 
-    for (size_t i = kernelSize - 1; i < attentionWeightsNorm.size() - kernelSize + 1; ++i) {
-        if (attentionWeightsNorm[i] >= threshold) {
-            indices.push_back(i - kernelSize + 1);
+    // Dot products between the domain vectors and the features
+    // [numConvs]
+    Eigen::VectorXf attentionWeights(winOffsets.back());
+
+    // Final representations
+    // [numFilters, numDocs]
+    Eigen::MatrixXf result(numFilters, docs.size());
+
+    // cached features are activated already, ReLU(x + 0) leaves them as they are
+    Eigen::VectorXf zeroBias;
+    auto *bias = convBias.data();
+    if (cachesWindows()) {
+        zeroBias.setZero(numFilters);
+        bias = zeroBias.data();
+    }
+
+    for (size_t j = 0; j < docs.size(); ++j) {
+        // Apply bias, ReLU, domain attention and attention pooling in a single pass over the document's features
+        auto numWindows = docs[j]->tokens.size() + kernelSize - 1;
+        Eigen::VectorXf domain = attentionDomains.row(domainIdx[j]).transpose();
+        auto *docFeatures = features.col(winOffsets[j]).data();
+        auto *docWeights = attentionWeights.data() + winOffsets[j];
+
+        auto bounds = intraOpChunks(numWindows);
+        auto numChunks = bounds.size() - 1;
+        if (numChunks == 1) {
+            shapeKernels->pool(docFeatures, numWindows, bias, domain.data(), docWeights, result.col(j).data(),
+                               {embDim, kernelSize, numFilters});
+            continue;
         }
+
+        // Each chunk is pooled with its own softmax, then the chunks are merged: chunk c's softmax sum relative to
+        // the global maximum weight is sumExp(c) * exp(maxWeight(c) - max)
+        // [numFilters, numChunks]
+        Eigen::MatrixXf partial(numFilters, numChunks);
+        Eigen::VectorXf maxWeight(numChunks), sumExp(numChunks);
+        runChunks(bounds, [&](size_t c) {
+            auto size = bounds[c + 1] - bounds[c];
+            shapeKernels->pool(docFeatures + bounds[c] * numFilters, size, bias, domain.data(), docWeights + bounds[c],
+                               partial.col(c).data(), {embDim, kernelSize, numFilters});
+            Eigen::Map<const Eigen::VectorXf> weights(docWeights + bounds[c], size);
+            maxWeight(c) = weights.maxCoeff();
+            sumExp(c) = (weights.array() - maxWeight(c)).exp().sum();
+        });
+        Eigen::VectorXf chunkWeights = (maxWeight.array() - maxWeight.maxCoeff()).exp() * sumExp.array();
+        result.col(j) = partial * chunkWeights / chunkWeights.sum();
     }
 
-    // Softmax layer
-    Eigen::VectorXf expOne = attentionWeights.array().exp();
-    float sumExp = expOne.sum();
-    // [numConvs]
-    attentionWeights = expOne / sumExp;
+    // [numClasses * numDomains, numDocs]
+    auto logits = fullyConnected(result);
 
-    // Final representation
-    // [numFilters]
-    Eigen::VectorXf result(numFilters);
-    result.setZero();
+    std::vector<Prediction> predictions(docs.size());
+    for (size_t j = 0; j < docs.size(); ++j) {
+        auto numTokens = docs[j]->tokens.size();
+        predictions[j].attention = normalizeAttention(
+            attentionWeights.segment(winOffsets[j], numTokens + kernelSize - 1), numTokens, kernelSize);
+        predictions[j].logits = logits.block(numClasses * domainIdx[j], j, numClasses, 1);
+    }
+    return predictions;
+}
+
+std::vector<model::Prediction>
+model::ASTCODAModel::predictAllDomains(const Document &doc) const
+{
+    const Document *docs[] = {&doc};
+    auto winOffsets = windowOffsets(docs);
+    auto numTokens = doc.tokens.size();
+    auto numWindows = numTokens + kernelSize - 1;
+
+    // [numFilters, numWindows]
+    Eigen::MatrixXf features = convolve(docs, winOffsets).leftCols(numWindows);
+    if (!cachesWindows()) {
+        features = (features.colwise() + convBias).cwiseMax(0.0f);
+    }
+
+    // Attention weights of all the domains at once
+    // [numDomains, numWindows]
+    Eigen::MatrixXf attentionWeights = attentionDomains * features;
 
-    ind = 0;
-    for (auto &feat : features) {
-        auto p = feat.array() * attentionWeights(ind++);
-        result += p.matrix();
+    // Softmax of each domain's weights over the windows
+    // [numDomains, numWindows]
+    Eigen::MatrixXf softmax = (attentionWeights.colwise() - attentionWeights.rowwise().maxCoeff()).array().exp();
+    softmax.array().colwise() /= softmax.rowwise().sum().array();
+
+    // Representations of the document for every domain
+    // [numFilters, numDomains]
+    Eigen::MatrixXf pooled = features * softmax.transpose();
+
+    // Every head applied to every representation, a domain's logits are on the diagonal blocks
+    // [numClasses * numDomains, numDomains]
+    auto logits = fullyConnected(pooled);
+
+    std::vector<Prediction> predictions(numDomains);
+    for (size_t d = 0; d < numDomains; ++d) {
+        predictions[d].attention = normalizeAttention(attentionWeights.row(d).transpose(), numTokens, kernelSize);
+        predictions[d].logits = logits.block(numClasses * d, d, numClasses, 1);
     }
+    return predictions;
+}
 
-    // Logits
-    // [numClasses]
-    Eigen::VectorXf logits = fcMatrix.block(numClasses * domainIdx, 0, numClasses, numFilters) * result +
-                             fcBias.block(numClasses * domainIdx, 0, numClasses, 1);
+model::Prediction
+model::ASTCODAModel::predict(const Document &doc, size_t domainIdx) const
+{
+    const Document *docs[] = {&doc};
+    return std::move(predictBatch(docs, {&domainIdx, 1}).front());
+}
 
+std::set<size_t>
+model::chooseLines(const Prediction &prediction, const std::vector<size_t> &positions, float threshold)
+{
     std::set<size_t> resultLines;
-    if (logits(0) < logits(1)) {
-        for (auto &ind : indices) {
-            resultLines.insert(positions[ind]);
+    if (prediction.logits(0) < prediction.logits(1)) {
+        for (size_t i = 0; i < static_cast<size_t>(prediction.attention.size()); ++i) {
+            if (prediction.attention[i] >= threshold) {
+                resultLines.insert(positions[i]);
+            }
         }
     } else {
         resultLines.insert(0);
     }
     return resultLines;
 }
+
+size_t
+model::bestDomain(const std::vector<Prediction> &predictions)
+{
+    // softmax probability of the predicted class: 1 / sum(exp(logit - max logit))
+    auto confidence = [](const Eigen::VectorXf &logits) {
+        return 1.0f / (logits.array() - logits.maxCoeff()).exp().sum();
+    };
+
+    size_t best = 0;
+    float bestConfidence = predictions.empty() ? 0 : confidence(predictions[0].logits);
+    for (size_t d = 1; d < predictions.size(); ++d) {
+        if (auto c = confidence(predictions[d].logits); c > bestConfidence) {
+            best = d;
+            bestConfidence = c;
+        }
+    }
+    return best;
+}
+
+std::set<size_t>
+model::ASTCODAModel::run(const std::string &filePath, size_t domainIdx) const
+{
+    auto doc = parse(filePath);
+    return chooseLines(predict(doc, domainIdx), doc.positions, threshold);
+}
+
+std::vector<std::set<size_t>>
+model::ASTCODAModel::runAllDomains(const std::string &filePath) const
+{
+    auto doc = parse(filePath);
+
+    std::vector<std::set<size_t>> result;
+    for (auto &prediction : predictAllDomains(doc)) {
+        result.push_back(chooseLines(prediction, doc.positions, threshold));
+    }
+    return result;
+}
+
+std::vector<std::set<size_t>>
+model::ASTCODAModel::runBatch(const std::vector<Document> &docs, const std::vector<size_t> &domainIdx) const
+{
+    std::vector<const Document *> ptrs;
+    for (auto &doc : docs) {
+        ptrs.push_back(&doc);
+    }
+
+    auto predictions = predictBatch(ptrs, domainIdx);
+
+    std::vector<std::set<size_t>> result;
+    for (size_t j = 0; j < docs.size(); ++j) {
+        result.push_back(chooseLines(predictions[j], docs[j].positions, threshold));
+    }
+    return result;
+}
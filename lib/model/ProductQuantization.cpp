@@ -0,0 +1,237 @@
+#include <model/ProductQuantization.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+
+namespace
+{
+
+// columns processed at once when looking for the nearest centroids
+constexpr size_t assignBlock = 4096;
+
+/// Function that finds the nearest centroid of each column
+/// @param centroids - [subDim, numCentroids]
+/// @param x - [subDim, n] sub-vectors
+/// @param nearest - n outputs, consecutive ones are stride apart
+void
+assign(const Eigen::MatrixXf &centroids, const Eigen::Ref<const Eigen::MatrixXf> &x, uint8_t *nearest, size_t stride)
+{
+    // |x - c|^2 = |c|^2 - 2 c.x + |x|^2, the last term doesn't change the nearest centroid
+    Eigen::VectorXf norms = centroids.colwise().squaredNorm().transpose();
+    Eigen::MatrixXf distances(centroids.cols(), std::min<Eigen::Index>(x.cols(), assignBlock));
+    for (Eigen::Index begin = 0; begin < x.cols(); begin += assignBlock) {
+        auto n = std::min<Eigen::Index>(assignBlock, x.cols() - begin);
+        distances.leftCols(n).noalias() = -2 * centroids.transpose() * x.middleCols(begin, n);
+        distances.leftCols(n).colwise() += norms;
+        for (Eigen::Index i = 0; i < n; ++i) {
+            Eigen::Index best;
+            distances.col(i).minCoeff(&best);
+            nearest[(begin + i) * stride] = static_cast<uint8_t>(best);
+        }
+    }
+}
+
+/// Function that copies the s'th sub-vectors of the given rows into columns
+Eigen::MatrixXf
+subvectors(const model::Embeddings &embeddings, const std::vector<size_t> &rows, size_t s, size_t subDim)
+{
+    auto vectors = embeddings.vectors();
+    Eigen::MatrixXf x(subDim, rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        x.col(i) = vectors.row(rows[i]).segment(s * subDim, subDim).transpose();
+    }
+    return x;
+}
+
+template <typename T>
+void
+readArray(std::ifstream &file, T *data, size_t size)
+{
+    if (!file.read(reinterpret_cast<char *>(data), size * sizeof(T))) {
+        throw std::runtime_error("Unexpected end of the product-quantized embeddings!");
+    }
+}
+
+} // namespace
+
+model::PqCodebook
+model::pq::train(const Embeddings &embeddings, size_t numSubspaces, size_t numCentroids, size_t iterations,
+                 size_t sampleSize, uint64_t seed)
+{
+    if (!embeddings.dense()) {
+        throw std::runtime_error("Only fp32 embeddings can be product-quantized!");
+    }
+    if (numSubspaces == 0 || embeddings.dim() % numSubspaces != 0) {
+        throw std::runtime_error("The embedding dimension must be divisible by the number of subspaces!");
+    }
+    if (numCentroids == 0 || numCentroids > 256) {
+        throw std::runtime_error("The number of centroids must be in [1, 256]!");
+    }
+
+    // random sample of the rows, its first numCentroids rows are the initial centroids
+    std::vector<size_t> sample(embeddings.size());
+    std::iota(sample.begin(), sample.end(), 0);
+    std::mt19937_64 rng(seed);
+    std::shuffle(sample.begin(), sample.end(), rng);
+    sample.resize(std::min(sampleSize, sample.size()));
+
+    auto subDim = embeddings.dim() / numSubspaces;
+    PqCodebook codebook;
+    codebook.numSubspaces = numSubspaces;
+    codebook.numCentroids = std::min(numCentroids, sample.size());
+    codebook.centroids.resize(numSubspaces * codebook.numCentroids * subDim);
+
+    std::vector<uint8_t> nearest(sample.size());
+    for (size_t s = 0; s < numSubspaces; ++s) {
+        // [subDim, sampleSize]
+        auto x = subvectors(embeddings, sample, s, subDim);
+        // [subDim, numCentroids]
+        Eigen::MatrixXf centroids = x.leftCols(codebook.numCentroids);
+
+        Eigen::MatrixXf sums(subDim, codebook.numCentroids);
+        std::vector<size_t> counts(codebook.numCentroids);
+        for (size_t it = 0; it < iterations; ++it) {
+            assign(centroids, x, nearest.data(), 1);
+
+            sums.setZero();
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = 0; i < sample.size(); ++i) {
+                sums.col(nearest[i]) += x.col(i);
+                ++counts[nearest[i]];
+            }
+            // an empty cluster keeps its centroid
+            for (size_t c = 0; c < codebook.numCentroids; ++c) {
+                if (counts[c] != 0) {
+                    centroids.col(c) = sums.col(c) / counts[c];
+                }
+            }
+        }
+
+        // a column-major [subDim, numCentroids] matrix is numCentroids consecutive centroids
+        std::copy(centroids.data(), centroids.data() + centroids.size(),
+                  codebook.centroids.data() + s * codebook.numCentroids * subDim);
+    }
+    return codebook;
+}
+
+model::Embeddings
+model::pq::encode(const Embeddings &embeddings, PqCodebook codebook)
+{
+    if (!embeddings.dense()) {
+        throw std::runtime_error("Only fp32 embeddings can be product-quantized!");
+    }
+    auto numSubspaces = codebook.numSubspaces;
+    auto subDim = embeddings.dim() / numSubspaces;
+
+    std::vector<uint8_t> codes(embeddings.size() * numSubspaces);
+    // [subDim, numTokens] view of the s'th sub-vectors of the row-major table
+    for (size_t s = 0; s < numSubspaces; ++s) {
+        Eigen::Map<const Eigen::MatrixXf, 0, Eigen::OuterStride<>> x(embeddings.vectors().data() + s * subDim, subDim,
+                                                                     embeddings.size(),
+                                                                     Eigen::OuterStride<>(embeddings.dim()));
+        Eigen::Map<const Eigen::MatrixXf> centroids(codebook.centroids.data() + s * codebook.numCentroids * subDim,
+                                                    subDim, codebook.numCentroids);
+        assign(centroids, x, codes.data() + s, numSubspaces);
+    }
+
+    std::vector<std::string> tokens;
+    tokens.reserve(embeddings.size());
+    for (size_t row = 0; row < embeddings.size(); ++row) {
+        tokens.emplace_back(embeddings.tokens().token(row));
+    }
+    return Embeddings(std::move(codes), std::move(codebook), embeddings.dim(), TokenIndex(tokens));
+}
+
+void
+model::pq::save(const std::filesystem::path &path, const Embeddings &embeddings)
+{
+    if (!embeddings.quantized()) {
+        throw std::runtime_error("Only product-quantized embeddings can be saved in this format!");
+    }
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create " + path.string());
+    }
+
+    auto &codebook = embeddings.pqCodebook();
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.numTokens = embeddings.size();
+    header.embDim = embeddings.dim();
+    header.numSubspaces = codebook.numSubspaces;
+    header.numCentroids = codebook.numCentroids;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(codebook.centroids.data()), codebook.centroids.size() * sizeof(float));
+
+    auto codes = embeddings.pqCodes();
+    for (size_t row = 0; row < embeddings.size(); ++row) {
+        auto token = embeddings.tokens().token(row);
+        uint32_t length = token.size();
+        file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+        file.write(token.data(), length);
+        file.write(reinterpret_cast<const char *>(codes.data() + row * codebook.numSubspaces), codebook.numSubspaces);
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+}
+
+bool
+model::pq::isPqFile(const std::filesystem::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char fileMagic[sizeof(magic)] = {};
+    return file.read(fileMagic, sizeof(fileMagic)) && std::memcmp(fileMagic, magic, sizeof(magic)) == 0;
+}
+
+model::Embeddings
+model::pq::load(const std::filesystem::path &path, const std::unordered_set<std::string> &vocabulary)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+
+    Header header;
+    readArray(file, &header, 1);
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version) {
+        throw std::runtime_error(path.string() + " isn't product-quantized embeddings of version " +
+                                 std::to_string(version));
+    }
+    if (header.numSubspaces == 0 || header.embDim % header.numSubspaces != 0 || header.numCentroids == 0 ||
+        header.numCentroids > 256) {
+        throw std::runtime_error("Invalid product quantization parameters in " + path.string());
+    }
+
+    PqCodebook codebook;
+    codebook.numSubspaces = header.numSubspaces;
+    codebook.numCentroids = header.numCentroids;
+    codebook.centroids.resize(header.numCentroids * header.embDim);
+    readArray(file, codebook.centroids.data(), codebook.centroids.size());
+
+    bool restricted = !vocabulary.empty();
+    std::vector<std::string> tokens;
+    std::vector<uint8_t> codes;
+    std::vector<uint8_t> rowCodes(header.numSubspaces);
+    for (size_t row = 0; row < header.numTokens; ++row) {
+        uint32_t length;
+        readArray(file, &length, 1);
+        std::string token(length, '\0');
+        readArray(file, token.data(), length);
+        readArray(file, rowCodes.data(), rowCodes.size());
+        // a code indexes the centroids of its subspace, a larger one would read past the codebook
+        if (std::ranges::any_of(rowCodes, [&](uint8_t code) { return code >= header.numCentroids; })) {
+            throw std::runtime_error("Invalid code of " + token + " in " + path.string());
+        }
+
+        if (!restricted || vocabulary.contains(token) || token == "@@UNK@@") {
+            tokens.push_back(std::move(token));
+            codes.insert(codes.end(), rowCodes.begin(), rowCodes.end());
+        }
+    }
+    return Embeddings(std::move(codes), std::move(codebook), header.embDim, TokenIndex(tokens));
+}
@@ -0,0 +1,122 @@
+#include <model/Projection.h>
+#include <algorithm>
+
+namespace
+{
+
+/// Function that projects embeddings by each offset of the convolution
+/// @param convMatrix - [numFilters, embDim * kernelSize], W_k is the contiguous [numFilters, embDim] block k
+/// @param embeddings - [embDim, n] embeddings
+/// @param dst - [n][kernelSize][numFilters] output
+void
+project(const float *convMatrix, const float *embeddings, size_t n, float *dst, size_t embDim, size_t kernelSize,
+        size_t numFilters)
+{
+    Eigen::Map<const Eigen::MatrixXf> e(embeddings, embDim, n);
+    for (size_t k = 0; k < kernelSize; ++k) {
+        Eigen::Map<const Eigen::MatrixXf> w(convMatrix + k * numFilters * embDim, numFilters, embDim);
+        Eigen::Map<Eigen::MatrixXf, 0, Eigen::OuterStride<>> out(dst + k * numFilters, numFilters, n,
+                                                                 Eigen::OuterStride<>(kernelSize * numFilters));
+        out.noalias() = w * e;
+    }
+}
+
+} // namespace
+
+model::ProjectionTable::ProjectionTable(size_t numTokens, size_t embDim, size_t kernelSize, size_t numFilters)
+    : embDim(embDim), kernelSize(kernelSize), numFilters(numFilters), slots(numTokens),
+      blocks((numTokens + blockRows - 1) / blockRows)
+{
+}
+
+void
+model::ProjectionTable::projectAll(const Embeddings &embeddings, const float *convMatrix)
+{
+    std::lock_guard lock(mutex);
+    // The slot of a row is the row itself, so each block is projected straight from the row-major embedding table
+    // (a product-quantized or 16-bit table is decoded block by block)
+    // [embDim, blockRows]
+    Eigen::MatrixXf decoded(embeddings.dense() ? 0 : embDim, blockRows);
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        size_t begin = b * blockRows;
+        size_t n = std::min(blockRows, slots.size() - begin);
+        if (!blocks[b]) {
+            blocks[b] = std::make_unique<float[]>(blockRows * kernelSize * numFilters);
+        }
+        const float *block = nullptr;
+        if (!embeddings.dense()) {
+            for (size_t i = 0; i < n; ++i) {
+                embeddings.decode(begin + i, decoded.col(i).data());
+            }
+            block = decoded.data();
+        } else {
+            block = embeddings.vectors().data() + begin * embDim;
+        }
+        project(convMatrix, block, n, blocks[b].get(), embDim, kernelSize, numFilters);
+    }
+    for (size_t row = 0; row < slots.size(); ++row) {
+        slots[row].store(row + 1, std::memory_order_release);
+    }
+    numSlots = slots.size();
+}
+
+void
+model::ProjectionTable::lookup(std::span<const uint32_t> rows, const float **projections,
+                               const Embeddings &embeddings, const float *convMatrix)
+{
+    bool complete = true;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        auto s = slots[rows[i]].load(std::memory_order_acquire);
+        projections[i] = s == 0 ? nullptr : slot(s - 1);
+        complete &= s != 0;
+    }
+    if (complete) {
+        return;
+    }
+
+    std::lock_guard lock(mutex);
+    // rows that are still missing (another thread may have projected some of them), each one once
+    std::vector<uint32_t> missing;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (projections[i] == nullptr && slots[rows[i]].load(std::memory_order_relaxed) == 0) {
+            missing.push_back(rows[i]);
+        }
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+    // [embDim, numMissing]
+    Eigen::MatrixXf missingEmbeddings(embDim, missing.size());
+    for (size_t i = 0; i < missing.size(); ++i) {
+        embeddings.decode(missing[i], missingEmbeddings.col(i).data());
+    }
+    std::vector<float> projected(missing.size() * kernelSize * numFilters);
+    project(convMatrix, missingEmbeddings.data(), missing.size(), projected.data(), embDim, kernelSize, numFilters);
+
+    // slots are filled in order and blocks are never moved, so readers of published slots aren't disturbed
+    size_t next = numSlots;
+    for (size_t i = 0; i < missing.size(); ++i, ++next) {
+        if (!blocks[next / blockRows]) {
+            blocks[next / blockRows] = std::make_unique<float[]>(blockRows * kernelSize * numFilters);
+        }
+        auto *src = projected.data() + i * kernelSize * numFilters;
+        std::copy(src, src + kernelSize * numFilters, slot(next));
+        slots[missing[i]].store(next + 1, std::memory_order_release);
+    }
+    numSlots = next;
+
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (projections[i] == nullptr) {
+            projections[i] = slot(slots[rows[i]].load(std::memory_order_relaxed) - 1);
+        }
+    }
+}
+
+model::ProjectionTable::Stats
+model::ProjectionTable::stats() const
+{
+    std::lock_guard lock(mutex);
+    size_t allocated = std::count_if(blocks.begin(), blocks.end(), [](auto &b) { return b != nullptr; });
+    return {numSlots, allocated * blockRows * kernelSize * numFilters * sizeof(float) +
+                          slots.size() * sizeof(uint32_t)};
+}
@@ -0,0 +1,158 @@
+#include <model/Quantization.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MODEL_QUANT_X86
+#include <immintrin.h>
+#endif
+
+model::quant::Int8Matrix
+model::quant::quantizeRows(const Eigen::Ref<const Eigen::MatrixXf> &m)
+{
+    Int8Matrix q;
+    q.rows = m.rows();
+    q.cols = m.cols();
+    q.stride = (q.cols + rowAlignment - 1) / rowAlignment * rowAlignment;
+    q.data.assign(q.rows * q.stride, 0);
+    q.scales.resize(q.rows);
+    q.rowSums.resize(q.rows);
+
+    // [cols]
+    Eigen::VectorXf row(q.cols);
+    for (size_t r = 0; r < q.rows; ++r) {
+        row = m.row(r).transpose();
+        auto *dst = q.data.data() + r * q.stride;
+        q.scales[r] = quantize(row.data(), q.cols, dst);
+        q.rowSums[r] = std::accumulate(dst, dst + q.cols, int32_t(0));
+    }
+    return q;
+}
+
+float
+model::quant::quantize(const float *src, size_t n, int8_t *dst)
+{
+    float maxAbs = 0;
+    for (size_t i = 0; i < n; ++i) {
+        maxAbs = std::max(maxAbs, std::abs(src[i]));
+    }
+    if (maxAbs == 0) {
+        std::fill(dst, dst + n, 0);
+        return 1;
+    }
+
+    // -128 is never produced, so the AVX2 kernel can take absolute values
+    float scale = maxAbs / 127;
+    float inv = 1 / scale;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = static_cast<int8_t>(std::clamp(std::lround(src[i] * inv), -127l, 127l));
+    }
+    return scale;
+}
+
+namespace
+{
+
+void
+gemvScalar(const model::quant::Int8Matrix &m, const int8_t *a, int32_t *out)
+{
+    for (size_t r = 0; r < m.rows; ++r) {
+        auto *w = m.data.data() + r * m.stride;
+        int32_t acc = 0;
+        for (size_t c = 0; c < m.cols; ++c) {
+            acc += int32_t(w[c]) * int32_t(a[c]);
+        }
+        out[r] = acc;
+    }
+}
+
+#ifdef MODEL_QUANT_X86
+
+__attribute__((target("avx2"))) void
+gemvAvx2(const model::quant::Int8Matrix &m, const int8_t *a, int32_t *out)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (size_t r = 0; r < m.rows; ++r) {
+        auto *w = m.data.data() + r * m.stride;
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t c = 0; c < m.stride; c += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + c));
+            __m256i vw = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + c));
+            // maddubs multiplies unsigned by signed bytes: move a's sign onto w.
+            // |a|, |w| <= 127, so the pairwise int16 sums can't saturate
+            __m256i absA = _mm256_sign_epi8(va, va);
+            __m256i signedW = _mm256_sign_epi8(vw, va);
+            __m256i pairs = _mm256_maddubs_epi16(absA, signedW);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+        }
+        __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum = _mm_hadd_epi32(sum, sum);
+        sum = _mm_hadd_epi32(sum, sum);
+        out[r] = _mm_cvtsi128_si32(sum);
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni"))) void
+gemvAvx512Vnni(const model::quant::Int8Matrix &m, const int8_t *a, int32_t *out)
+{
+    // dpbusd multiplies unsigned by signed bytes: use a + 128 and subtract 128 * sum(w) afterwards
+    const __m512i offset = _mm512_set1_epi8(static_cast<char>(0x80));
+    for (size_t r = 0; r < m.rows; ++r) {
+        auto *w = m.data.data() + r * m.stride;
+        __m512i acc = _mm512_setzero_si512();
+        for (size_t c = 0; c < m.stride; c += 64) {
+            __m512i ua = _mm512_xor_si512(_mm512_loadu_si512(a + c), offset);
+            acc = _mm512_dpbusd_epi32(acc, ua, _mm512_loadu_si512(w + c));
+        }
+        out[r] = _mm512_reduce_add_epi32(acc) - 128 * m.rowSums[r];
+    }
+}
+
+#endif
+
+} // namespace
+
+model::quant::Isa
+model::quant::detectIsa()
+{
+#ifdef MODEL_QUANT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vnni")) {
+        return Isa::Avx512Vnni;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return Isa::Avx2;
+    }
+#endif
+    return Isa::Scalar;
+}
+
+model::quant::GemvKernel
+model::quant::gemvKernel(Isa isa)
+{
+    switch (isa) {
+#ifdef MODEL_QUANT_X86
+    case Isa::Avx512Vnni:
+        return gemvAvx512Vnni;
+    case Isa::Avx2:
+        return gemvAvx2;
+#endif
+    default:
+        return gemvScalar;
+    }
+}
+
+std::string
+model::quant::isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa::Avx512Vnni:
+        return "avx512_vnni";
+    case Isa::Avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,115 @@
+#include <model/Scores.h>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+
+template <typename T>
+void
+writeArray(std::ofstream &file, const T *data, size_t size)
+{
+    file.write(reinterpret_cast<const char *>(data), size * sizeof(T));
+}
+
+template <typename T>
+void
+readArray(std::ifstream &file, T *data, size_t size)
+{
+    if (!file.read(reinterpret_cast<char *>(data), size * sizeof(T))) {
+        throw std::runtime_error("Unexpected end of the scores file!");
+    }
+}
+
+/// Function that checks that the rest of the file can hold count elements before they are allocated, so a corrupted
+/// count fails instead of allocating more than the file holds
+void
+checkRemaining(std::ifstream &file, uintmax_t fileSize, uint64_t count, size_t elementSize)
+{
+    auto remaining = fileSize - static_cast<uintmax_t>(file.tellg());
+    if (count > remaining / elementSize) {
+        throw std::runtime_error("Unexpected end of the scores file!");
+    }
+}
+
+} // namespace
+
+void
+model::writeScores(const std::filesystem::path &path, const std::vector<ScoredFile> &files)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create scores file " + path.string());
+    }
+
+    scores::Header header{};
+    std::memcpy(header.magic, scores::magic, sizeof(scores::magic));
+    header.version = scores::version;
+    header.numFiles = files.size();
+    writeArray(file, &header, 1);
+
+    std::vector<uint32_t> positions;
+    for (auto &f : files) {
+        uint32_t nameLength = f.name.size();
+        uint32_t numClasses = f.prediction.logits.size();
+        uint64_t n = f.prediction.attention.size();
+        if (f.positions.size() < n) {
+            throw std::runtime_error("Each attention weight of " + f.name + " needs a position!");
+        }
+        positions.assign(f.positions.begin(), f.positions.begin() + n);
+
+        writeArray(file, &nameLength, 1);
+        writeArray(file, f.name.data(), nameLength);
+        writeArray(file, &numClasses, 1);
+        writeArray(file, &n, 1);
+        writeArray(file, f.prediction.logits.data(), numClasses);
+        writeArray(file, f.prediction.attention.data(), n);
+        writeArray(file, positions.data(), n);
+    }
+
+    if (!file) {
+        throw std::runtime_error("Failed to write scores file " + path.string());
+    }
+}
+
+std::vector<model::ScoredFile>
+model::readScores(const std::filesystem::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open scores file " + path.string());
+    }
+
+    scores::Header header;
+    readArray(file, &header, 1);
+    if (std::memcmp(header.magic, scores::magic, sizeof(scores::magic)) != 0 || header.version != scores::version) {
+        throw std::runtime_error(path.string() + " is not a scores file of version " + std::to_string(scores::version));
+    }
+
+    auto fileSize = std::filesystem::file_size(path);
+    // a record takes at least its name length, numClasses and n
+    checkRemaining(file, fileSize, header.numFiles, 2 * sizeof(uint32_t) + sizeof(uint64_t));
+    std::vector<ScoredFile> files(header.numFiles);
+    std::vector<uint32_t> positions;
+    for (auto &f : files) {
+        uint32_t nameLength, numClasses;
+        uint64_t n;
+        readArray(file, &nameLength, 1);
+        checkRemaining(file, fileSize, nameLength, 1);
+        f.name.resize(nameLength);
+        readArray(file, f.name.data(), nameLength);
+        readArray(file, &numClasses, 1);
+        readArray(file, &n, 1);
+        checkRemaining(file, fileSize, numClasses, sizeof(float));
+        checkRemaining(file, fileSize, n, sizeof(float) + sizeof(uint32_t));
+
+        f.prediction.logits.resize(numClasses);
+        readArray(file, f.prediction.logits.data(), numClasses);
+        f.prediction.attention.resize(n);
+        readArray(file, f.prediction.attention.data(), n);
+        positions.resize(n);
+        readArray(file, positions.data(), n);
+        f.positions.assign(positions.begin(), positions.end());
+    }
+    return files;
+}
@@ -0,0 +1,93 @@
+#include <model/WindowCache.h>
+#include <algorithm>
+
+model::WindowCache::WindowCache(size_t capacity, size_t windowSize, size_t featureSize)
+    : capacity(capacity), windowSize(windowSize), featureSize(featureSize)
+{
+    for (size_t i = 0; i < numShards; ++i) {
+        shards[i].capacity = capacity / numShards + (i < capacity % numShards);
+        shards[i].byHash.reserve(shards[i].capacity);
+    }
+}
+
+uint64_t
+model::WindowCache::hash(const uint32_t *window, size_t windowSize)
+{
+    // 64-bit FNV-1a over the ids, followed by a finalizer that spreads the bits (byHash uses the low ones)
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < windowSize; ++i) {
+        h = (h ^ window[i]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+bool
+model::WindowCache::find(const uint32_t *window, float *feature)
+{
+    auto h = hash(window, windowSize);
+    auto &shard = shardOf(h);
+
+    std::lock_guard lock(shard.mutex);
+    ++shard.lookups;
+    auto it = shard.byHash.find(h);
+    // a collision of two different windows counts as a miss
+    if (it == shard.byHash.end() || !std::equal(window, window + windowSize, it->second->window.begin())) {
+        return false;
+    }
+    ++shard.hits;
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    std::copy(it->second->feature.begin(), it->second->feature.end(), feature);
+    return true;
+}
+
+void
+model::WindowCache::insert(const uint32_t *window, const float *feature)
+{
+    auto h = hash(window, windowSize);
+    auto &shard = shardOf(h);
+    if (shard.capacity == 0) {
+        return;
+    }
+
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.byHash.find(h);
+    std::list<Entry>::iterator entry;
+    if (it != shard.byHash.end()) {
+        // the same window computed by another thread, or a colliding one that replaces it
+        entry = it->second;
+    } else if (shard.entries.size() < shard.capacity) {
+        entry = shard.entries.insert(shard.entries.begin(),
+                                     {h, std::vector<uint32_t>(windowSize), std::vector<float>(featureSize)});
+        shard.byHash.emplace(h, entry);
+    } else {
+        // reuse the least recently used entry, so a full cache doesn't allocate
+        entry = std::prev(shard.entries.end());
+        shard.byHash.erase(entry->hash);
+        entry->hash = h;
+        shard.byHash.emplace(h, entry);
+        ++shard.evictions;
+    }
+
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry);
+    std::copy(window, window + windowSize, entry->window.begin());
+    std::copy(feature, feature + featureSize, entry->feature.begin());
+}
+
+model::WindowCache::Stats
+model::WindowCache::stats() const
+{
+    Stats stats;
+    stats.capacity = capacity;
+    for (auto &shard : shards) {
+        std::lock_guard lock(shard.mutex);
+        stats.lookups += shard.lookups;
+        stats.hits += shard.hits;
+        stats.evictions += shard.evictions;
+        stats.size += shard.entries.size();
+    }
+    stats.bytes = stats.size * (sizeof(Entry) + windowSize * sizeof(uint32_t) + featureSize * sizeof(float));
+    return stats;
+}
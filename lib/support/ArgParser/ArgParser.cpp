@@ -79,7 +79,7 @@ argparser::Arguments::fromJSON(const std::string &pathJSON)
                 temp.back() = '\0';
                 param->setValue(vit->second, temp);
             }
-        } else {
+        } else if (!optional.contains(key)) {
             throw std::format("There's no {} among keys in the given JSON {}!", key.sharg, pathJSON);
         }
     }
@@ -0,0 +1,109 @@
+#include <support/Support/Positions.h>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+void
+writeVarint(std::ostream &out, uint64_t value)
+{
+    char bytes[10];
+    size_t n = 0;
+    for (; value >= 0x80; value >>= 7) {
+        bytes[n++] = static_cast<char>(value | 0x80);
+    }
+    bytes[n++] = static_cast<char>(value);
+    out.write(bytes, n);
+}
+
+uint64_t
+readVarint(const unsigned char *&it, const unsigned char *end)
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (it == end) {
+            throw std::runtime_error("Unexpected end of the positions file!");
+        }
+        auto byte = *it++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Malformed varint in the positions file!");
+}
+
+} // namespace
+
+void
+support::writePositionsHeader(std::ostream &out, uint64_t numDocs)
+{
+    positions::Header header{};
+    std::memcpy(header.magic, positions::magic, sizeof(positions::magic));
+    header.version = positions::version;
+    header.numDocs = numDocs;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+void
+support::writePositionsRecord(std::ostream &out, const std::vector<size_t> &positions)
+{
+    writeVarint(out, positions.size());
+    int64_t prev = 0;
+    for (auto line : positions) {
+        auto delta = static_cast<int64_t>(line) - prev;
+        writeVarint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+        prev = static_cast<int64_t>(line);
+    }
+}
+
+std::vector<std::vector<size_t>>
+support::readPositions(const std::filesystem::path &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open positions file " + path.string());
+    }
+    std::vector<unsigned char> data(std::istreambuf_iterator<char>(file), {});
+
+    positions::Header header;
+    if (data.size() < sizeof(header)) {
+        throw std::runtime_error(path.string() + " is not a positions file");
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if (std::memcmp(header.magic, positions::magic, sizeof(positions::magic)) != 0 ||
+        header.version != positions::version) {
+        throw std::runtime_error(path.string() + " is not a positions file of version " +
+                                 std::to_string(positions::version));
+    }
+
+    const unsigned char *it = data.data() + sizeof(header);
+    const unsigned char *end = data.data() + data.size();
+    // every record takes at least one byte, so a corrupted count can't allocate more than the file holds
+    if (header.numDocs > static_cast<uint64_t>(end - it)) {
+        throw std::runtime_error(path.string() + " has fewer records than its header says");
+    }
+    std::vector<std::vector<size_t>> docs(header.numDocs);
+    for (auto &doc : docs) {
+        auto n = readVarint(it, end);
+        // every value takes at least one byte
+        if (n > static_cast<uint64_t>(end - it)) {
+            throw std::runtime_error("Unexpected end of the positions file!");
+        }
+        doc.resize(n);
+        int64_t line = 0;
+        for (auto &p : doc) {
+            auto zigzag = readVarint(it, end);
+            line += static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+            p = static_cast<size_t>(line);
+        }
+    }
+    if (it != end) {
+        throw std::runtime_error(path.string() + " has more records than its header says");
+    }
+    return docs;
+}
@@ -61,3 +61,46 @@ support::splitLine(const std::string &line, char delimiter)
     }
     return tokens;
 }
+
+std::map<std::string, size_t>
+support::readIndex(const std::filesystem::path &path)
+{
+    std::map<std::string, size_t> index;
+    std::ifstream f(path);
+    std::string line;
+    size_t idx = 0;
+    while (std::getline(f, line)) {
+        index[line] = idx++;
+    }
+    f.close();
+    return index;
+}
+
+size_t
+support::countLines(const std::filesystem::path &path)
+{
+    std::ifstream f(path);
+    std::string line;
+    size_t numLines = 0;
+    while (std::getline(f, line)) {
+        ++numLines;
+    }
+    f.close();
+    return numLines;
+}
+
+std::map<std::string, size_t>
+support::readSubmissionDomains(const std::filesystem::path &path, const std::map<std::string, size_t> &domain2idx)
+{
+    std::map<std::string, size_t> sub2domain;
+    std::ifstream f(path);
+    std::string line;
+    while (std::getline(f, line)) {
+        auto li = splitLine(line, ',');
+        auto dom = splitLine(li[1], '_');
+        auto it = domain2idx.find(dom[0]);
+        sub2domain[li[0]] = it != domain2idx.end() ? it->second : 0;
+    }
+    f.close();
+    return sub2domain;
+}
@@ -0,0 +1,130 @@
+#include <support/ThreadPool/TaskGraph.h>
+#include <atomic>
+#include <optional>
+#include <stdexcept>
+
+struct threadpool::TaskGraph::Launch {
+    // [numTasks] dependencies of each task that aren't done yet
+    std::vector<std::atomic_size_t> waiting;
+    // tasks that are neither done nor skipped yet
+    std::atomic_size_t left;
+    std::atomic_bool failed = false;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    std::shared_ptr<detail::FutureState<void>> done;
+
+    Launch(size_t numTasks, std::shared_ptr<detail::FutureState<void>> done)
+        : waiting(numTasks), left(numTasks), done(std::move(done))
+    {
+    }
+};
+
+size_t
+threadpool::TaskGraph::add(std::move_only_function<void()> func, std::initializer_list<size_t> dependencies)
+{
+    nodes.push_back({std::move(func), {}, 0});
+    auto idx = nodes.size() - 1;
+    for (auto dependency : dependencies) {
+        precede(dependency, idx);
+    }
+    return idx;
+}
+
+void
+threadpool::TaskGraph::precede(size_t before, size_t after)
+{
+    if (before >= nodes.size() || after >= nodes.size()) {
+        throw std::runtime_error("Unknown task of the graph!");
+    }
+    nodes[before].successors.push_back(after);
+    ++nodes[after].numDependencies;
+}
+
+threadpool::Future<void>
+threadpool::TaskGraph::launch(ThreadPool &pool)
+{
+    // Kahn's algorithm: if some task never gets free of dependencies, there is a cycle
+    std::vector<size_t> numDependencies(nodes.size());
+    std::vector<size_t> roots, order;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        numDependencies[i] = nodes[i].numDependencies;
+        if (numDependencies[i] == 0) {
+            roots.push_back(i);
+            order.push_back(i);
+        }
+    }
+    for (size_t k = 0; k < order.size(); ++k) {
+        for (auto s : nodes[order[k]].successors) {
+            if (--numDependencies[s] == 0) {
+                order.push_back(s);
+            }
+        }
+    }
+    if (order.size() != nodes.size()) {
+        throw std::runtime_error("The tasks of the graph depend on each other in a cycle!");
+    }
+
+    auto done = std::make_shared<detail::FutureState<void>>(&pool);
+    if (nodes.empty()) {
+        done->run([] {});
+        return Future<void>(std::move(done));
+    }
+
+    auto launch = std::make_shared<Launch>(nodes.size(), done);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        launch->waiting[i].store(nodes[i].numDependencies, std::memory_order_relaxed);
+    }
+    for (auto root : roots) {
+        detail::post(pool, [this, &pool, launch, root] { visit(pool, launch, root); });
+    }
+    return Future<void>(std::move(done));
+}
+
+void
+threadpool::TaskGraph::visit(ThreadPool &pool, const std::shared_ptr<Launch> &launch, size_t i)
+{
+    while (true) {
+        if (!launch->failed.load(std::memory_order_relaxed)) {
+            try {
+                nodes[i].func();
+            } catch (...) {
+                std::lock_guard lk(launch->errorMutex);
+                if (!launch->error) {
+                    launch->error = std::current_exception();
+                }
+                launch->failed.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        std::optional<size_t> next;
+        for (auto s : nodes[i].successors) {
+            if (launch->waiting[s].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (!next) {
+                    next = s;
+                } else {
+                    detail::post(pool, [this, &pool, launch, s] { visit(pool, launch, s); });
+                }
+            }
+        }
+
+        // the graph may be gone once the last task is counted, so nothing touches it afterwards
+        if (launch->left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (launch->error) {
+                launch->done->fail(launch->error);
+            } else {
+                launch->done->run([] {});
+            }
+            return;
+        }
+        if (!next) {
+            return;
+        }
+        i = *next;
+    }
+}
+
+void
+threadpool::TaskGraph::run(ThreadPool &pool)
+{
+    launch(pool).get();
+}
@@ -1,61 +1,340 @@
 #include <support/ThreadPool/ThreadPool.h>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <latch>
+#include <utility>
 
-threadpool::ThreadPool::ThreadPool(size_t numThreads) : tasks(numThreads)
-{
-    for (size_t i = 0; i < numThreads; ++i) {
-        // the i'th worker is doing its job...
-        workers.push(size_t(i));
-
-        threads.emplace_back([&, i](const std::stop_token &stop_tok) {
-            while (!stop_tok.stop_requested()) {
-                // enter the critical section
-                tasks[i].semaphore.acquire();
-                // while still there're tasks in a queue
-                while (waitingTasks.load(std::memory_order_acquire) > 0) {
-                    while (auto task = tasks[i].tasks.pop()) {
-                        // decrease the number of waiting tasks
-                        waitingTasks.fetch_sub(1, std::memory_order_release);
-                        // process the given task
-                        std::invoke(std::move(task.value()));
-                        // decrease the total number of tasks
-                        totalLeftTasks.fetch_sub(1, std::memory_order_release);
-                    }
-                    // if the i'th worker has processed all its tasks, it can do non-processed tasks of another
-                    // workers
-                    for (size_t j = 1; j < tasks.size(); ++j) {
-                        auto workerIdx = (i + j) % tasks.size();
-                        if (auto task = tasks[workerIdx].tasks.pop()) {
-                            // decrease the number of waiting tasks
-                            waitingTasks.fetch_sub(1, std::memory_order_release);
-                            // process the given task
-                            std::invoke(std::move(task.value()));
-                            // decrease the total number of tasks
-                            totalLeftTasks.fetch_sub(1, std::memory_order_release);
-                            break;
+namespace
+{
+
+// the pool and the index of the worker that runs on this thread, if any
+thread_local const threadpool::ThreadPool *currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+int64_t
+nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/// Function that tells the CPU the thread is spinning
+inline void
+cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+} // namespace
+
+// at least one worker: a pool without workers would never run its tasks
+threadpool::ThreadPool::ThreadPool(size_t numThreads, size_t spinRounds)
+    : deques(std::max<size_t>(numThreads, 1)), shards(deques.size()), workerStates(deques.size()),
+      spinRounds(std::thread::hardware_concurrency() > 1 ? spinRounds : 0)
+{
+    for (size_t i = 0; i < deques.size(); ++i) {
+        threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+void
+threadpool::ThreadPool::submit(Job *job)
+{
+    unfinished.fetch_add(1, std::memory_order_relaxed);
+
+    if (currentPool == this) {
+        // a task of this pool: the worker will most likely take it next, while its data is still in the cache
+        deques[currentWorker].push(job);
+    } else {
+        auto &shard = shards[nextShard.fetch_add(1, std::memory_order_relaxed) % shards.size()];
+        std::lock_guard lk(shard.m);
+        shard.jobs.push_back(job);
+        shard.queued.store(shard.jobs.size(), std::memory_order_relaxed);
+    }
+
+    // seq_cst pairs with a worker that stops spinning or goes to sleep: either it sees the new epoch, or this sees it
+    // spinning (then it will take the task) or on the idle stack (then a worker is woken)
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    if (spinning.load(std::memory_order_seq_cst) == 0 && sleeping.load(std::memory_order_seq_cst) > 0) {
+        wakeOne();
+    }
+}
+
+void
+threadpool::detail::post(ThreadPool &pool, std::move_only_function<void()> job)
+{
+    pool.submit(new ThreadPool::Job(std::move(job)));
+}
+
+void
+threadpool::ThreadPool::wakeOne()
+{
+    size_t i;
+    {
+        std::lock_guard lk(idleMutex);
+        if (idle.empty()) {
+            return;
+        }
+        i = idle.back();
+        idle.pop_back();
+        sleeping.store(idle.size(), std::memory_order_relaxed);
+        // the woken worker searches like a spinning one: the tasks added meanwhile don't wake others, it wakes the
+        // next worker itself once it has a task
+        spinning.fetch_add(1, std::memory_order_seq_cst);
+        // under the lock: a worker that finds itself off the stack knows the flag is already set
+        workerStates[i].woken.store(true, std::memory_order_release);
+    }
+    wakeups.fetch_add(1, std::memory_order_relaxed);
+    workerStates[i].woken.notify_one();
+}
+
+bool
+threadpool::ThreadPool::park(size_t i, uint32_t seen)
+{
+    auto &state = workerStates[i];
+    {
+        std::lock_guard lk(idleMutex);
+        idle.push_back(i);
+        sleeping.store(idle.size(), std::memory_order_seq_cst);
+    }
+
+    // seq_cst pairs with submit: a task added before the worker was on the stack may have found nobody to wake
+    if (epoch.load(std::memory_order_seq_cst) != seen || stopping.load(std::memory_order_seq_cst)) {
+        std::lock_guard lk(idleMutex);
+        if (auto it = std::find(idle.begin(), idle.end(), i); it != idle.end()) {
+            idle.erase(it);
+            sleeping.store(idle.size(), std::memory_order_relaxed);
+            return false;
+        }
+        // somebody has woken it already
+        state.woken.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    state.parks.fetch_add(1, std::memory_order_relaxed);
+    state.woken.wait(false, std::memory_order_acquire);
+    state.woken.store(false, std::memory_order_relaxed);
+    return true;
+}
+
+void
+threadpool::ThreadPool::forChunks(size_t numChunks, std::move_only_function<void(size_t)> chunk)
+{
+    // shared with the helper tasks: a helper that starts after the last chunk is claimed only reads next
+    struct Range {
+        std::move_only_function<void(size_t)> chunk;
+        size_t numChunks;
+        std::atomic_size_t next = 0;
+        std::latch done;
+        std::atomic_bool failed = false;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        Range(std::move_only_function<void(size_t)> chunk, size_t numChunks)
+            : chunk(std::move(chunk)), numChunks(numChunks), done(static_cast<std::ptrdiff_t>(numChunks))
+        {
+        }
+
+        void
+        run()
+        {
+            for (size_t c; (c = next.fetch_add(1, std::memory_order_relaxed)) < numChunks;) {
+                if (!failed.load(std::memory_order_relaxed)) {
+                    try {
+                        chunk(c);
+                    } catch (...) {
+                        std::lock_guard lk(errorMutex);
+                        if (!error) {
+                            error = std::current_exception();
                         }
+                        failed.store(true, std::memory_order_relaxed);
                     }
                 }
+                done.count_down();
+            }
+        }
+    };
+    auto range = std::make_shared<Range>(std::move(chunk), numChunks);
+
+    // a worker of this pool takes part, so it only waits for chunks that other threads are running; a thread from
+    // outside only waits, so the pool keeps its number of threads
+    bool inside = currentPool == this;
+    auto numHelpers = inside ? std::min(numChunks - 1, size() - 1) : std::min(numChunks, size());
+    for (size_t h = 0; h < numHelpers; ++h) {
+        submit(new Job([range] { range->run(); }));
+    }
+    if (inside) {
+        range->run();
+    }
+    range->done.wait();
+
+    // taken out of the shared state, which a helper that starts late may be the last one to release
+    if (auto error = std::exchange(range->error, nullptr)) {
+        std::rethrow_exception(error);
+    }
+}
+
+threadpool::ThreadPool::Job *
+threadpool::ThreadPool::findJob(size_t i)
+{
+    Job *job = nullptr;
+    if (deques[i].pop(job)) {
+        return job;
+    }
 
-                // if all tasks were processed, finish job
-                if (totalLeftTasks.load(std::memory_order_acquire) == 0) {
-                    doneThreads.store(true, std::memory_order_release);
-                    doneThreads.notify_one();
+    for (size_t j = 0; j < shards.size(); ++j) {
+        auto &shard = shards[(i + j) % shards.size()];
+        // a task queued before the epoch the worker has read is seen here: submit writes queued before the epoch
+        if (shard.queued.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        std::lock_guard lk(shard.m);
+        if (!shard.jobs.empty()) {
+            job = shard.jobs.front();
+            shard.jobs.pop_front();
+            shard.queued.store(shard.jobs.size(), std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    for (size_t j = 1; j < deques.size(); ++j) {
+        if (deques[(i + j) % deques.size()].steal(job)) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void
+threadpool::ThreadPool::work(size_t i)
+{
+    currentPool = this;
+    currentWorker = i;
+
+    auto &stats = workerStates[i];
+    auto endIdle = [&] {
+        if (auto since = stats.idleSince.exchange(0, std::memory_order_relaxed); since != 0) {
+            stats.idleNanos.fetch_add(nowNanos() - since, std::memory_order_relaxed);
+        }
+    };
+    // pause instructions spun in the current idle period, whether the worker is counted in spinning, and whether it
+    // is counted there because it was woken
+    size_t spun = 0;
+    bool isSpinning = false;
+    bool isWoken = false;
+    auto stopSpinning = [&] {
+        isSpinning = false;
+        return spinning.fetch_sub(1, std::memory_order_seq_cst) == 1;
+    };
+
+    while (true) {
+        // read before looking for a task: a task added after the search changes it, so the wait below returns
+        auto seen = epoch.load(std::memory_order_seq_cst);
+        if (auto *job = findJob(i)) {
+            endIdle();
+            spun = 0;
+            if (isSpinning) {
+                if (!isWoken) {
+                    stats.spinHits.fetch_add(1, std::memory_order_relaxed);
+                }
+                // submitters don't wake anybody while a worker spins, so the last one to stop wakes a worker for
+                // the tasks that may have come after this one, and that one wakes the next in turn
+                if (stopSpinning() && sleeping.load(std::memory_order_seq_cst) > 0) {
+                    wakeOne();
                 }
             }
-        });
+            isWoken = false;
+
+            std::invoke(*job);
+            delete job;
+            stats.tasks.fetch_add(1, std::memory_order_relaxed);
+            if (unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                unfinished.notify_all();
+            }
+            continue;
+        }
+
+        if (stats.idleSince.load(std::memory_order_relaxed) == 0) {
+            stats.idleSince.store(nowNanos(), std::memory_order_relaxed);
+        }
+        if (stopping.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        // spin first: a task that comes soon is taken without the cost of sleeping and being woken
+        if (spun < spinRounds) {
+            if (!isSpinning) {
+                isSpinning = true;
+                spinning.fetch_add(1, std::memory_order_seq_cst);
+            }
+            for (; spun < spinRounds && epoch.load(std::memory_order_relaxed) == seen; ++spun) {
+                cpuRelax();
+            }
+            if (epoch.load(std::memory_order_relaxed) != seen) {
+                continue;
+            }
+        }
+
+        if (isSpinning) {
+            stopSpinning();
+        }
+        isWoken = park(i, seen);
+        isSpinning = isWoken;
+    }
+
+    endIdle();
+    if (isSpinning) {
+        stopSpinning();
+    }
+}
+
+threadpool::ThreadPool::Stats
+threadpool::ThreadPool::stats() const
+{
+    Stats result;
+    int64_t idleNanos = 0;
+    auto now = nowNanos();
+    for (auto &s : workerStates) {
+        result.tasks += s.tasks.load(std::memory_order_relaxed);
+        result.spinHits += s.spinHits.load(std::memory_order_relaxed);
+        result.parks += s.parks.load(std::memory_order_relaxed);
+        // the finished idle periods first, then the current one: a period that ends in between is left out rather
+        // than counted twice
+        idleNanos += s.idleNanos.load(std::memory_order_relaxed);
+        if (auto since = s.idleSince.load(std::memory_order_relaxed); since != 0) {
+            idleNanos += std::max<int64_t>(now - since, 0);
+        }
+    }
+    result.wakeups = wakeups.load(std::memory_order_relaxed);
+    result.idleSeconds = idleNanos * 1e-9;
+    return result;
+}
+
+void
+threadpool::ThreadPool::wait()
+{
+    for (auto left = unfinished.load(std::memory_order_acquire); left != 0;
+         left = unfinished.load(std::memory_order_acquire)) {
+        unfinished.wait(left, std::memory_order_acquire);
     }
 }
 
 threadpool::ThreadPool::~ThreadPool()
 {
     // wait until all tasks are processed
-    if (totalLeftTasks.load(std::memory_order_acquire) > 0) {
-        doneThreads.wait(false);
-    }
-    // finishing processing: stopping threads and releasing the corresponding semaphores
-    for (size_t i = 0; i < threads.size(); ++i) {
-        threads[i].request_stop();
-        tasks[i].semaphore.release();
-        threads[i].join();
+    wait();
+
+    // finishing processing: waking and stopping the workers, a worker that goes to sleep afterwards sees stopping
+    stopping.store(true, std::memory_order_seq_cst);
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    while (sleeping.load(std::memory_order_seq_cst) > 0) {
+        wakeOne();
+    }
+    for (auto &thread : threads) {
+        thread.join();
     }
 }
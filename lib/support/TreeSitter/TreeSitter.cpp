@@ -387,6 +387,17 @@ treesitter::Tree::Tree(const std::string &fileName, const std::string &lang)
     file.close();
 
     src = ss.str();
+    parse(lang);
+}
+
+treesitter::Tree::Tree(std::string source, const std::string &lang, FromSource) : src(std::move(source))
+{
+    parse(lang);
+}
+
+void
+treesitter::Tree::parse(const std::string &lang)
+{
     parser = ts_parser_new();
 
     // ts_parser_set_language(parser, languages[lang]());
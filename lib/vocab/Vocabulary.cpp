@@ -1,4 +1,38 @@
 #include <vocab/Vocabulary.h>
+#include <support/ThreadPool/ThreadPool.h>
+#include <algorithm>
+#include <cctype>
+
+namespace
+{
+
+bool
+isSpace(char c)
+{
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+/// Function that collects the unique whitespace-separated tokens of text[begin, end)
+std::set<std::string>
+collectTokens(const std::string &text, size_t begin, size_t end)
+{
+    std::set<std::string> tokens;
+    for (auto pos = begin; pos < end;) {
+        while (pos < end && isSpace(text[pos])) {
+            ++pos;
+        }
+        auto start = pos;
+        while (pos < end && !isSpace(text[pos])) {
+            ++pos;
+        }
+        if (pos > start) {
+            tokens.emplace(text, start, pos - start);
+        }
+    }
+    return tokens;
+}
+
+} // namespace
 
 void
 vocabulary::Vocabulary::printVocab(const std::string &filepath, const std::set<std::string> &vocab)
@@ -18,7 +52,8 @@ vocabulary::Vocabulary::printVocab(const std::string &filepath, const json &voca
     f.close();
 }
 
-vocabulary::Vocabulary::Vocabulary(const std::vector<std::string> &classesTemp) : classes(classesTemp)
+vocabulary::Vocabulary::Vocabulary(const std::vector<std::string> &classesTemp, size_t numThreads)
+    : classes(classesTemp), numThreads(std::max<size_t>(numThreads, 1))
 {
     std::sort(classes.begin(), classes.end());
 };
@@ -26,12 +61,35 @@ vocabulary::Vocabulary::Vocabulary(const std::vector<std::string> &classesTemp)
 void
 vocabulary::Vocabulary::addTokens(const std::string &filepath)
 {
-    std::ifstream f(filepath);
-    for (const auto &line : std::ranges::istream_view<std::string>(f)) {
+    // the file is read in blocks that end at whitespace, each block is split between the threads
+    constexpr size_t blockSize = 64 << 20;
+    std::ifstream f(filepath, std::ios::binary);
+    threadpool::ThreadPool pool(numThreads);
+    std::string block;
+    while (f) {
+        block.resize(blockSize);
+        f.read(block.data(), blockSize);
+        block.resize(f.gcount());
+        for (char c; !block.empty() && !isSpace(block.back()) && f.get(c);) {
+            block.push_back(c);
+        }
+
+        // chunks end at whitespace as well, so no token is split between two of them
+        auto numChunks = numThreads * 4;
+        std::vector<size_t> bounds = {0};
+        for (size_t c = 1; c < numChunks; ++c) {
+            auto pos = std::max(block.size() / numChunks * c, bounds.back());
+            while (pos < block.size() && !isSpace(block[pos])) {
+                ++pos;
+            }
+            bounds.push_back(pos);
+        }
+        bounds.push_back(block.size());
 
-        auto tokens = support::splitLine(line, ' ');
-        for (auto &token : tokens) {
-            tokenSet.insert(token);
+        auto chunkTokens =
+            pool.parallelMap(0, numChunks, 1, [&](size_t c) { return collectTokens(block, bounds[c], bounds[c + 1]); });
+        for (auto &tokens : chunkTokens) {
+            tokenSet.merge(tokens);
         }
     }
     f.close();
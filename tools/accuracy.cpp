@@ -0,0 +1,189 @@
+#include <model/Model.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+#include <support/Support/Support.h>
+
+struct Parameters : public argparser::Arguments {
+    // shapes of a weights directory, a bundle has its own
+    size_t embDim = 0;
+    size_t kernelSize = 0;
+    size_t numFilters = 0;
+    std::string pathDomainIdx;
+    std::string pathLabelIdx;
+    std::string pathTestX;
+    std::string pathTestY;
+    std::string pathModel;
+    std::string pathBundle;
+    std::string lang;
+    size_t minLen;
+    double threshold;
+    std::string variant = "int8";
+    // "pq", "fp16", "bf16": weights directory converted by the pq or the half tool, the shapes are the same
+    std::string pathVariantModel;
+    std::string isa = "auto";
+    // 0: all the files
+    size_t maxFiles = 0;
+    double minAgreement = 0.99;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"test_x">(pathTestX, DirectoryArgument<std::string>());
+        addParam<"test_y">(pathTestY, FileArgument<std::string>());
+        addParam<"label_to_idx">(pathLabelIdx, FileArgument<std::string>());
+        addParam<"domain_to_idx">(pathDomainIdx, FileArgument<std::string>());
+        addParam<"embedding_dim">(embDim, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"kernel_size">(kernelSize, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"num_filters">(numFilters, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"weights_path">(pathModel, DirectoryArgument<std::string>(), false);
+        addParam<"bundle">(pathBundle, FileArgument<std::string>(), false);
+        addParam<"lang">(lang, ConstrainedArgument<std::string>({"c", "cpp"}));
+        addParam<"minlen">(minLen, RangeArgument<size_t>({1, INT_MAX}));
+        addParam<"threshold">(threshold, RangeArgument<double>({-1.0, 1.0}));
+        addParam<"variant">(variant, ConstrainedArgument<std::string>({"int8", "pq", "fp16", "bf16"}), false);
+        addParam<"variant_weights_path">(pathVariantModel, DirectoryArgument<std::string>(), false);
+        addParam<"isa">(isa, ConstrainedArgument<std::string>({"auto", "avx512_vnni", "avx2", "scalar"}), false);
+        addParam<"max_files">(maxFiles, RangeArgument<size_t>({0, INT_MAX}), false);
+        addParam<"min_agreement">(minAgreement, RangeArgument<double>({0.0, 1.0}), false);
+    }
+};
+
+/// Jaccard similarity of two line sets
+double
+jaccard(const std::set<size_t> &a, const std::set<size_t> &b)
+{
+    std::vector<size_t> common;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(common));
+    auto united = a.size() + b.size() - common.size();
+    return united == 0 ? 1.0 : double(common.size()) / united;
+}
+
+/// Compares a reduced-precision variant of a model (int8 arithmetic, product-quantized embeddings or 16-bit weights)
+/// with the fp32 one on a test set:
+/// predicted classes, logits and chosen lines
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+        if (params.pathBundle.empty() == params.pathModel.empty()) {
+            throw std::string("Exactly one of bundle and weights_path is required!");
+        }
+        if (!params.pathModel.empty() && (params.embDim == 0 || params.kernelSize == 0 || params.numFilters == 0)) {
+            throw std::string("weights_path needs embedding_dim, kernel_size and num_filters!");
+        }
+        if (params.variant != "int8" && (params.pathModel.empty() || params.pathVariantModel.empty())) {
+            throw std::string("The " + params.variant + " variant needs weights_path and variant_weights_path!");
+        }
+
+        auto domain2idx = support::readIndex(params.pathDomainIdx);
+        size_t numDomains = support::countLines(params.pathDomainIdx);
+        size_t numLabels = support::countLines(params.pathLabelIdx);
+        auto y2domain = support::readSubmissionDomains(params.pathTestY, domain2idx);
+
+        auto mod = params.pathBundle.empty()
+                       ? model::ASTCODAModel(params.pathModel, params.kernelSize, params.embDim, params.numFilters,
+                                             numLabels, numLabels / numDomains, params.lang, params.minLen,
+                                             params.threshold)
+                       : model::ASTCODAModel(std::filesystem::path(params.pathBundle), params.lang, params.minLen,
+                                             params.threshold);
+
+        std::map<std::string, model::quant::Isa> isas = {{"avx512_vnni", model::quant::Isa::Avx512Vnni},
+                                                         {"avx2", model::quant::Isa::Avx2},
+                                                         {"scalar", model::quant::Isa::Scalar}};
+        auto isa = params.isa == "auto" ? model::quant::detectIsa() : isas.at(params.isa);
+        if (isa > model::quant::detectIsa()) {
+            throw std::string("The CPU doesn't support " + model::quant::isaName(isa));
+        }
+
+        std::vector<std::filesystem::path> files;
+        for (auto const &fileEntry : std::filesystem::directory_iterator{params.pathTestX}) {
+            files.push_back(fileEntry.path());
+        }
+        std::sort(files.begin(), files.end());
+        if (params.maxFiles != 0 && files.size() > params.maxFiles) {
+            files.resize(params.maxFiles);
+        }
+
+        std::vector<model::Document> docs;
+        std::vector<size_t> domains;
+        for (auto &file : files) {
+            docs.push_back(mod.parse(file.string()));
+            domains.push_back(y2domain[file.filename().string()]);
+        }
+
+        using Clock = std::chrono::steady_clock;
+        auto predictAll = [&](const model::ASTCODAModel &m, double &seconds) {
+            std::vector<model::Prediction> predictions;
+            auto start = Clock::now();
+            for (size_t j = 0; j < docs.size(); ++j) {
+                predictions.push_back(m.predict(docs[j], domains[j]));
+            }
+            seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            return predictions;
+        };
+
+        double refSeconds, variantSeconds;
+        auto reference = predictAll(mod, refSeconds);
+        std::vector<model::Prediction> variant;
+        std::string variantName = params.variant;
+        if (params.variant == "int8") {
+            mod.setPrecision(model::Precision::Int8, isa);
+            variant = predictAll(mod, variantSeconds);
+            variantName += " (" + model::quant::isaName(isa) + ")";
+        } else {
+            auto dtype = params.variant == "pq" ? model::half::DType::Float32 : model::half::parseDType(params.variant);
+            model::ASTCODAModel variantMod(params.pathVariantModel, params.kernelSize, params.embDim,
+                                           params.numFilters, numLabels, numLabels / numDomains, params.lang,
+                                           params.minLen, params.threshold, 0, {}, dtype);
+            variant = predictAll(variantMod, variantSeconds);
+        }
+
+        size_t sameClass = 0, sameLines = 0;
+        double maxDiff = 0, sumDiff = 0, sumJaccard = 0;
+        for (size_t j = 0; j < docs.size(); ++j) {
+            auto &ref = reference[j];
+            auto &var = variant[j];
+            sameClass += (ref.logits(0) < ref.logits(1)) == (var.logits(0) < var.logits(1));
+
+            auto diff = (ref.logits - var.logits).cwiseAbs();
+            maxDiff = std::max(maxDiff, double(diff.maxCoeff()));
+            sumDiff += diff.mean();
+
+            auto refLines = model::chooseLines(ref, docs[j].positions, params.threshold);
+            auto varLines = model::chooseLines(var, docs[j].positions, params.threshold);
+            sameLines += refLines == varLines;
+            sumJaccard += jaccard(refLines, varLines);
+        }
+
+        double n = std::max<size_t>(docs.size(), 1);
+        double agreement = sameClass / n;
+        std::cout << "Variant: " << variantName << "\n"
+                  << "Files: " << docs.size() << "\n"
+                  << "Class agreement: " << agreement << "\n"
+                  << "Logits abs diff: max " << maxDiff << ", mean " << sumDiff / n << "\n"
+                  << "Same chosen lines: " << sameLines / n << "\n"
+                  << "Mean Jaccard of chosen lines: " << sumJaccard / n << "\n"
+                  << "Inference time: fp32 " << refSeconds << " s, " << params.variant << " " << variantSeconds
+                  << " s\n"
+                  << (agreement >= params.minAgreement ? "ACCEPT" : "REJECT") << std::endl;
+        return agreement >= params.minAgreement ? 0 : 2;
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,62 @@
+#include <model/Model.h>
+#include <iostream>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+#include <support/Support/Support.h>
+
+struct Parameters : public argparser::Arguments {
+    size_t embDim;
+    size_t kernelSize;
+    size_t numFilters;
+    std::string pathDomainIdx;
+    std::string pathLabelIdx;
+    std::string pathModel;
+    std::string pathBundle;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"label_to_idx">(pathLabelIdx, FileArgument<std::string>());
+        addParam<"domain_to_idx">(pathDomainIdx, FileArgument<std::string>());
+        addParam<"embedding_dim">(embDim, RangeArgument<size_t>({1, INT_MAX}));
+        addParam<"kernel_size">(kernelSize, RangeArgument<size_t>({1, INT_MAX}));
+        addParam<"num_filters">(numFilters, RangeArgument<size_t>({1, INT_MAX}));
+        addParam<"weights_path">(pathModel, DirectoryArgument<std::string>());
+        addParam<"bundle">(pathBundle, FileArgument<std::string>(false));
+    }
+};
+
+/// Converts a weights directory (embeddings.bin, conv_matrix.bin, bn_*.bin, fc_*.bin, ...) into a single bundle
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+
+        size_t numDomains = support::countLines(params.pathDomainIdx);
+        size_t numLabels = support::countLines(params.pathLabelIdx);
+
+        model::ASTCODAModel mod(params.pathModel, params.kernelSize, params.embDim, params.numFilters, numLabels,
+                                numLabels / numDomains, "c", 1, 0);
+        mod.save(params.pathBundle);
+
+        // check that the bundle can be read back
+        model::Bundle check(params.pathBundle, true);
+        std::cout << "Bundle " << params.pathBundle << ": " << check.header().numTokens << " tokens, "
+                  << std::filesystem::file_size(params.pathBundle) << " bytes" << std::endl;
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include <model/Ensemble.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+#include <support/Support/Support.h>
+#include <support/ThreadPool/ThreadPool.h>
+
+struct Parameters : public argparser::Arguments {
+    // models of the ensemble
+    std::vector<std::string> bundles;
+    std::string pathDomainIdx;
+    std::string pathTestX;
+    // output directory of extract with "positions": true, used instead of test_x to skip parsing
+    std::string pathCorpus;
+    std::string pathTestY;
+    std::string lang;
+    std::string outPath;
+    size_t minLen;
+    double threshold;
+    // "any", "majority" or "all" of the models must choose a line
+    std::string voting = "majority";
+    // if not 0, the number of models that must choose a line instead of voting
+    size_t minVotes = 0;
+    size_t numThreads = 1;
+    // submissions a worker runs at once
+    size_t batchSize = 1;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"bundles">(bundles, UnconstrainedArgument<std::vector<std::string>>());
+        addParam<"test_x">(pathTestX, DirectoryArgument<std::string>(), false);
+        addParam<"corpus">(pathCorpus, DirectoryArgument<std::string>(), false);
+        addParam<"test_y">(pathTestY, FileArgument<std::string>());
+        addParam<"domain_to_idx">(pathDomainIdx, FileArgument<std::string>());
+        addParam<"lang">(lang, ConstrainedArgument<std::string>({"c", "cpp"}));
+        addParam<"minlen">(minLen, RangeArgument<size_t>({1, INT_MAX}));
+        addParam<"threshold">(threshold, RangeArgument<double>({-1.0, 1.0}));
+        addParam<"chosen_lines">(outPath, FileArgument<std::string>(false));
+        addParam<"voting">(voting, ConstrainedArgument<std::string>({"any", "majority", "all"}), false);
+        addParam<"min_votes">(minVotes, RangeArgument<size_t>({0, INT_MAX}), false);
+        addParam<"threads">(numThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}), false);
+        addParam<"batch">(batchSize, RangeArgument<size_t>({1, INT_MAX}), false);
+    }
+};
+
+/// Generates the list of "suspicious" lines with several models: each submission is parsed once, the models vote on
+/// its lines
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+        if (params.pathTestX.empty() == params.pathCorpus.empty()) {
+            throw std::string("Exactly one of test_x and corpus is required!");
+        }
+
+        auto domain2idx = support::readIndex(params.pathDomainIdx);
+        auto y2domain = support::readSubmissionDomains(params.pathTestY, domain2idx);
+
+        // the output is sorted by file name, so it doesn't depend on the directory order or on the number of threads
+        std::vector<std::filesystem::path> files;
+        // documents of an extracted corpus, which are not parsed again
+        std::vector<model::Document> corpus;
+        if (!params.pathCorpus.empty()) {
+            for (auto &[name, doc] : model::readCorpus(params.pathCorpus)) {
+                files.push_back(name);
+                corpus.push_back(std::move(doc));
+            }
+        } else {
+            for (auto const &fileEntry : std::filesystem::directory_iterator{params.pathTestX}) {
+                files.push_back(fileEntry.path());
+            }
+            std::sort(files.begin(), files.end());
+        }
+
+        std::vector<size_t> domains;
+        for (auto &file : files) {
+            domains.push_back(y2domain[file.filename().string()]);
+        }
+
+        std::vector<std::unique_ptr<model::ASTCODAModel>> models;
+        for (auto &bundle : params.bundles) {
+            models.push_back(std::make_unique<model::ASTCODAModel>(std::filesystem::path(bundle), params.lang,
+                                                                   params.minLen, params.threshold));
+        }
+        auto numModels = models.size();
+        auto voting = params.voting == "any"   ? model::Voting::any()
+                      : params.voting == "all" ? model::Voting::all(numModels)
+                                               : model::Voting::majority(numModels);
+        if (params.minVotes != 0) {
+            voting.quorum = params.minVotes;
+        }
+        model::Ensemble ensemble(std::move(models), voting);
+        std::cerr << "Ensemble: " << ensemble.size() << " models, " << ensemble.numTables() << " embedding tables, "
+                  << voting.quorum << " votes choose a line" << std::endl;
+
+        // workers take batches of consecutive files, the results are written in order afterwards
+        std::vector<std::set<size_t>> results(files.size());
+        std::atomic_size_t nextFile = 0;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        auto work = [&] {
+            try {
+                for (size_t begin; (begin = nextFile.fetch_add(params.batchSize)) < files.size();) {
+                    auto end = std::min(begin + params.batchSize, files.size());
+                    std::vector<model::Document> docs;
+                    for (size_t i = begin; i < end; ++i) {
+                        docs.push_back(corpus.empty() ? ensemble.parse(files[i].string()) : std::move(corpus[i]));
+                    }
+                    auto lines = ensemble.runBatch(docs, {domains.begin() + begin, domains.begin() + end});
+                    std::move(lines.begin(), lines.end(), results.begin() + begin);
+                }
+            } catch (...) {
+                std::lock_guard lk(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                nextFile = files.size();
+            }
+        };
+        {
+            threadpool::ThreadPool workers(params.numThreads);
+            for (size_t t = 0; t < params.numThreads; ++t) {
+                auto res = workers.addTask(work);
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+
+        std::ofstream outFile(params.outPath);
+        for (size_t i = 0; i < files.size(); ++i) {
+            outFile << files[i].filename().string();
+            for (auto &v : results[i]) {
+                outFile << " " << v;
+            }
+            outFile << "\n";
+        }
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,41 +1,91 @@
 #include <model/Model.h>
+#include <model/Scores.h>
 #include <iostream>
 #include <string>
 #include <support/ArgParser/ArgParser.h>
 #include <support/Support/Support.h>
+#include <support/ThreadPool/BoundedQueue.h>
+#include <support/ThreadPool/ThreadPool.h>
+#include <algorithm>
+#include <exception>
 #include <filesystem>
 #include <map>
+#include <mutex>
+#include <unordered_set>
 
 struct Parameters : public argparser::Arguments {
-    size_t embDim;
-    size_t kernelSize;
-    size_t numFilters;
+    // shapes of a weights directory, a bundle has its own
+    size_t embDim = 0;
+    size_t kernelSize = 0;
+    size_t numFilters = 0;
     std::string pathDomainIdx;
     std::string pathLabelIdx;
     std::string pathTestX;
+    // output directory of extract with "positions": true, used instead of test_x to skip parsing
+    std::string pathCorpus;
     std::string pathTestY;
     std::string pathModel;
+    std::string pathBundle;
     std::string lang;
     std::string outPath;
+    // optional sidecar with the attention weights, positions and logits of every submission
+    std::string scoresPath;
+    // "given": domains from test_y, "best": guess each submission's domain
+    std::string domain = "given";
     size_t minLen;
     double threshold;
+    // inference workers
+    size_t numThreads = 1;
+    // workers that read and parse the submissions
+    size_t parseThreads = 1;
+    // parsed submissions an inference worker takes at once
+    size_t batchSize = 1;
+    // capacity of the queues between the stages
+    size_t queueSize = 64;
+    // load only the embeddings of the path-tokens that occur in test_x
+    bool restrictVocabulary = false;
+    // "off": one product per batch, "lazy"/"full": per-token projection tables (see model::ProjectionTable)
+    std::string projection = "off";
+    // threads per inference call, for long submissions (see model::ASTCODAModel::setIntraOpThreads)
+    size_t intraThreads = 1;
+    size_t intraMinWindows = 1024;
+    // number of cached window convolutions, 0: no cache
+    size_t windowCache = 0;
+    // storage type of a weights directory, see the half tool
+    std::string dtype = "fp32";
 
     Parameters()
     {
         using namespace argparser;
 
-        addParam<"test_x">(pathTestX, DirectoryArgument<std::string>());
+        addParam<"test_x">(pathTestX, DirectoryArgument<std::string>(), false);
+        addParam<"corpus">(pathCorpus, DirectoryArgument<std::string>(), false);
         addParam<"test_y">(pathTestY, FileArgument<std::string>());
         addParam<"label_to_idx">(pathLabelIdx, FileArgument<std::string>());
         addParam<"domain_to_idx">(pathDomainIdx, FileArgument<std::string>());
-        addParam<"embedding_dim">(embDim, RangeArgument<size_t>({1, INT_MAX}));
-        addParam<"kernel_size">(kernelSize, RangeArgument<size_t>({1, INT_MAX}));
-        addParam<"num_filters">(numFilters, RangeArgument<size_t>({1, INT_MAX}));
-        addParam<"weights_path">(pathModel, DirectoryArgument<std::string>());
+        addParam<"embedding_dim">(embDim, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"kernel_size">(kernelSize, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"num_filters">(numFilters, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"weights_path">(pathModel, DirectoryArgument<std::string>(), false);
+        addParam<"bundle">(pathBundle, FileArgument<std::string>(), false);
         addParam<"lang">(lang, ConstrainedArgument<std::string>({"c", "cpp"}));
         addParam<"minlen">(minLen, RangeArgument<size_t>({1, INT_MAX}));
         addParam<"threshold">(threshold, RangeArgument<double>({-1.0, 1.0}));
         addParam<"chosen_lines">(outPath, FileArgument<std::string>(false));
+        addParam<"scores">(scoresPath, FileArgument<std::string>(false), false);
+        addParam<"domain">(domain, ConstrainedArgument<std::string>({"given", "best"}), false);
+        addParam<"threads">(numThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}), false);
+        addParam<"parse_threads">(parseThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}),
+                                  false);
+        addParam<"batch">(batchSize, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"queue_size">(queueSize, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"restrict_vocabulary">(restrictVocabulary, ConstrainedArgument<bool>(), false);
+        addParam<"window_cache">(windowCache, RangeArgument<size_t>({0, INT_MAX}), false);
+        addParam<"intra_threads">(intraThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}),
+                                  false);
+        addParam<"intra_min_windows">(intraMinWindows, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"projection">(projection, ConstrainedArgument<std::string>({"off", "lazy", "full"}), false);
+        addParam<"dtype">(dtype, ConstrainedArgument<std::string>({"fp32", "fp16", "bf16"}), false);
     }
 };
 
@@ -45,63 +95,261 @@ main(int argc, char *argv[])
     try {
         Parameters params;
         params.fromJSON(argv[1]);
+        if (params.pathBundle.empty() == params.pathModel.empty()) {
+            throw std::string("Exactly one of bundle and weights_path is required!");
+        }
+        if (!params.pathModel.empty() && (params.embDim == 0 || params.kernelSize == 0 || params.numFilters == 0)) {
+            throw std::string("weights_path needs embedding_dim, kernel_size and num_filters!");
+        }
+        if (params.pathTestX.empty() == params.pathCorpus.empty()) {
+            throw std::string("Exactly one of test_x and corpus is required!");
+        }
 
         size_t embDim = params.embDim;
         size_t kernelSize = params.kernelSize;
         size_t numFilters = params.numFilters;
 
-        // read domains
-        std::map<std::string, size_t> domain2idx;
-        std::ifstream domain2idxFile(params.pathDomainIdx);
-        std::string line;
-        size_t numDomains = 0;
-        while (std::getline(domain2idxFile, line)) {
-            domain2idx[line] = numDomains++;
-        }
-        domain2idxFile.close();
+        auto domain2idx = support::readIndex(params.pathDomainIdx);
+        size_t numDomains = support::countLines(params.pathDomainIdx);
+        size_t numLabels = support::countLines(params.pathLabelIdx);
+        auto y2domain = support::readSubmissionDomains(params.pathTestY, domain2idx);
 
-        // read labels
-        std::ifstream label2idxFile(params.pathLabelIdx);
-        size_t numLabels = 0;
-        while (std::getline(label2idxFile, line)) {
-            ++numLabels;
+        // An extracted corpus already has the path-tokens and their lines, so its documents are ready for inference
+        std::vector<std::filesystem::path> files;
+        std::vector<model::Document> docs;
+        // the output is sorted by file name (readCorpus returns the documents in that order), so it doesn't depend on
+        // the directory order or on the number of threads
+        if (!params.pathCorpus.empty()) {
+            for (auto &[name, doc] : model::readCorpus(params.pathCorpus)) {
+                files.push_back(name);
+                docs.push_back(std::move(doc));
+            }
+        } else {
+            for (auto const &fileEntry : std::filesystem::directory_iterator{params.pathTestX}) {
+                files.push_back(fileEntry.path());
+            }
+            std::sort(files.begin(), files.end());
         }
-        label2idxFile.close();
 
-        // read csv
-        std::map<std::string, size_t> y2domain;
-        std::ifstream testY(params.pathTestY);
+        std::vector<size_t> domains;
+        for (auto &file : files) {
+            domains.push_back(y2domain[file.filename().string()]);
+        }
 
-        while (std::getline(testY, line)) {
-            auto li = support::splitLine(line, ',');
-            auto dom = support::splitLine(li[1], '_');
-            y2domain[li[0]] = domain2idx[dom[0]];
+        // A restricted vocabulary needs all the path-tokens of the test set before the model is loaded, so the files
+        // are parsed first (and the parsed documents are kept for inference). A bundle is memory-mapped and only the
+        // rows that are used are read anyway
+        std::unordered_set<std::string> vocabulary;
+        bool restrictVocabulary = params.restrictVocabulary && params.pathBundle.empty();
+        bool preParse = restrictVocabulary || !params.pathCorpus.empty();
+        if (preParse && params.pathCorpus.empty()) {
+            threadpool::ThreadPool pool(params.parseThreads);
+            docs = pool.parallelMap(0, files.size(), 1, [&](size_t i) {
+                return model::parseDocument(files[i].string(), params.lang, params.minLen);
+            });
+        }
+        if (restrictVocabulary) {
+            for (auto &doc : docs) {
+                vocabulary.insert(doc.tokens.begin(), doc.tokens.end());
+            }
         }
-        testY.close();
 
-        model::ASTCODAModel mod(params.pathModel, kernelSize, embDim, numFilters, numLabels, numLabels / numDomains,
-                                params.lang, params.minLen, params.threshold);
+        // a bundle already knows its shapes, otherwise load a weights directory
+        auto mod = params.pathBundle.empty()
+                       ? model::ASTCODAModel(params.pathModel, kernelSize, embDim, numFilters, numLabels,
+                                             numLabels / numDomains, params.lang, params.minLen, params.threshold, 0,
+                                             vocabulary, model::half::parseDType(params.dtype))
+                       : model::ASTCODAModel(std::filesystem::path(params.pathBundle), params.lang, params.minLen,
+                                             params.threshold);
+        mod.setWindowCache(params.windowCache);
+        mod.setIntraOpThreads(params.intraThreads, params.intraMinWindows);
+        std::map<std::string, model::ProjectionMode> projectionModes = {{"off", model::ProjectionMode::Off},
+                                                                         {"lazy", model::ProjectionMode::Lazy},
+                                                                         {"full", model::ProjectionMode::Full}};
+        mod.setProjection(projectionModes.at(params.projection));
 
-        std::filesystem::path testFolder = params.pathTestX;
-        std::ofstream outFile(params.outPath);
-        for (auto const &fileEntry : std::filesystem::directory_iterator{testFolder}) {
-            auto fname = fileEntry.path().filename().string();
+        // Pipeline: parse workers -> parsed queue -> inference workers -> scored queue -> ordered writer (this
+        // thread). The queues are bounded, so a fast stage waits for a slow one instead of piling up documents
+        struct Parsed {
+            size_t idx;
+            model::Document doc;
+        };
+        struct Scored {
+            size_t idx;
+            std::set<size_t> lines;
+            model::ScoredFile scores;
+        };
+        threadpool::BoundedQueue<Parsed> parsedQueue(params.queueSize);
+        threadpool::BoundedQueue<Scored> scoredQueue(params.queueSize);
+
+        // the first error stops the pipeline
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        auto fail = [&](std::exception_ptr e) {
+            {
+                std::lock_guard lk(errorMutex);
+                if (!error) {
+                    error = e;
+                }
+            }
+            parsedQueue.close();
+            scoredQueue.close();
+        };
+
+        std::atomic_size_t nextFile = 0;
+        std::atomic_size_t parsersLeft = params.parseThreads;
+        auto parseStage = [&] {
+            try {
+                for (size_t i; (i = nextFile++) < files.size();) {
+                    auto doc = preParse ? std::move(docs[i]) : mod.parse(files[i].string());
+                    if (!parsedQueue.push({i, std::move(doc)})) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                fail(std::current_exception());
+            }
+            if (--parsersLeft == 0) {
+                parsedQueue.close();
+            }
+        };
+
+        // inference is const, so the workers share the model
+        std::atomic_size_t workersLeft = params.numThreads;
+        auto inferenceStage = [&] {
+            try {
+                while (true) {
+                    auto batch = parsedQueue.popBatch(params.batchSize);
+                    if (batch.empty()) {
+                        break;
+                    }
 
-            auto vec = mod.run(fileEntry.path().string(), y2domain[fname]);
+                    std::vector<model::Prediction> predictions;
+                    if (params.domain == "best") {
+                        for (auto &p : batch) {
+                            auto all = mod.predictAllDomains(p.doc);
+                            predictions.push_back(std::move(all[model::bestDomain(all)]));
+                        }
+                    } else {
+                        std::vector<const model::Document *> batchDocs;
+                        std::vector<size_t> batchDomains;
+                        for (auto &p : batch) {
+                            batchDocs.push_back(&p.doc);
+                            batchDomains.push_back(domains[p.idx]);
+                        }
+                        predictions = mod.predictBatch(batchDocs, batchDomains);
+                    }
 
-            outFile << fname;
-            for (auto &v : vec) {
-                outFile << " " << v;
+                    for (size_t j = 0; j < batch.size(); ++j) {
+                        auto &[i, doc] = batch[j];
+                        Scored scored{i, model::chooseLines(predictions[j], doc.positions, params.threshold), {}};
+                        if (!params.scoresPath.empty()) {
+                            doc.positions.resize(predictions[j].attention.size());
+                            scored.scores = {files[i].filename().string(), std::move(predictions[j]),
+                                             std::move(doc.positions)};
+                        }
+                        if (!scoredQueue.push(std::move(scored))) {
+                            return;
+                        }
+                    }
+                }
+            } catch (...) {
+                fail(std::current_exception());
             }
-            outFile << "\n";
+            if (--workersLeft == 0) {
+                scoredQueue.close();
+            }
+        };
+
+        std::ofstream outFile(params.outPath);
+        std::vector<model::ScoredFile> scores(params.scoresPath.empty() ? 0 : files.size());
+        // results that came before the ones of the preceding files
+        std::map<size_t, Scored> pending;
+        size_t maxPending = 0;
+        threadpool::ThreadPool::Stats parserStats, workerStats;
+        {
+            threadpool::ThreadPool parsers(params.parseThreads);
+            threadpool::ThreadPool workers(params.numThreads);
+            // the stages pass their errors to fail(), the futures only carry what escapes them
+            std::vector<threadpool::Future<void>> stages;
+            for (size_t t = 0; t < params.parseThreads; ++t) {
+                stages.push_back(parsers.addTask(parseStage));
+            }
+            for (size_t t = 0; t < params.numThreads; ++t) {
+                stages.push_back(workers.addTask(inferenceStage));
+            }
+
+            // the output is sorted by file name and doesn't depend on the number of threads
+            size_t next = 0;
+            while (auto scored = scoredQueue.pop()) {
+                auto idx = scored->idx;
+                pending.emplace(idx, std::move(*scored));
+                maxPending = std::max(maxPending, pending.size());
+                for (auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.erase(it)) {
+                    outFile << files[next].filename().string();
+                    for (auto &v : it->second.lines) {
+                        outFile << " " << v;
+                    }
+                    outFile << "\n";
+                    if (!params.scoresPath.empty()) {
+                        scores[next] = std::move(it->second.scores);
+                    }
+                    ++next;
+                }
+            }
+            for (auto &stage : stages) {
+                stage.get();
+            }
+            parserStats = parsers.stats();
+            workerStats = workers.stats();
+        }
+        if (error) {
+            std::rethrow_exception(error);
         }
         outFile.close();
 
+        auto reportQueue = [](const std::string &name, const auto &stats) {
+            std::cerr << name << " queue: mean depth " << stats.meanDepth << ", max " << stats.maxDepth
+                      << ", producers waited " << stats.fullWaits << " times, consumers waited " << stats.emptyWaits
+                      << " times" << std::endl;
+        };
+        std::cerr << "Pipeline: " << params.parseThreads << " parse and " << params.numThreads
+                  << " inference threads, batches of " << params.batchSize << std::endl;
+        auto reportPool = [](const std::string &name, const threadpool::ThreadPool::Stats &stats) {
+            std::cerr << name << " threads: idle " << stats.idleSeconds << " s, slept " << stats.parks
+                      << " times, woken " << stats.wakeups << " times, " << stats.spinHits
+                      << " tasks found while spinning" << std::endl;
+        };
+        reportPool("Parse", parserStats);
+        reportPool("Inference", workerStats);
+        reportQueue("Parsed", parsedQueue.stats());
+        reportQueue("Scored", scoredQueue.stats());
+        std::cerr << "Reorder buffer: max " << maxPending << std::endl;
+
+        if (params.windowCache != 0) {
+            auto stats = mod.windowCacheStats();
+            std::cerr << "Window cache: " << stats.hits << " hits of " << stats.lookups << " lookups ("
+                      << stats.hitRate() * 100 << "%), " << stats.size << " windows, " << stats.bytes / (1 << 20)
+                      << " MiB, " << stats.evictions << " evictions" << std::endl;
+        }
+        if (params.projection != "off") {
+            auto stats = mod.projectionStats();
+            std::cerr << "Projection tables: " << stats.tokens << " path-tokens, " << stats.bytes / (1 << 20) << " MiB"
+                      << std::endl;
+        }
+
+        if (!params.scoresPath.empty()) {
+            model::writeScores(params.scoresPath, scores);
+        }
+
     } catch (const char *err) {
         std::cerr << err << std::endl;
         return 1;
     } catch (const std::string &s) {
         std::cerr << s << std::endl;
         return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
 }
@@ -12,6 +12,8 @@ struct Parameters : public argparser::Arguments {
     std::string token;
     std::string split;
     std::string outdir;
+    // also write positions.bin with the line of each path-token, evaluate can then skip parsing
+    bool positions = false;
 
     Parameters()
     {
@@ -27,6 +29,7 @@ struct Parameters : public argparser::Arguments {
         addParam<"split">(split, ConstrainedArgument<std::string>({"ids_hash"}));
         addParam<"outdir">(outdir, DirectoryArgument<std::string>(false));
         addParam<"mapping">(mapping, FileArgument<std::string>());
+        addParam<"positions">(positions, ConstrainedArgument<bool>(), false);
     }
 };
 
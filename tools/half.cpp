@@ -0,0 +1,133 @@
+#include <model/Model.h>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+
+struct Parameters : public argparser::Arguments {
+    std::string pathModel;
+    std::string pathOutput;
+    std::string dtype;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"weights_path">(pathModel, DirectoryArgument<std::string>());
+        addParam<"output">(pathOutput, DirectoryArgument<std::string>(false));
+        addParam<"dtype">(dtype, ConstrainedArgument<std::string>({"fp16", "bf16"}));
+    }
+};
+
+namespace
+{
+
+/// Function that reads a whole file of floats
+std::vector<float>
+readFloats(const std::filesystem::path &path)
+{
+    std::vector<float> values(std::filesystem::file_size(path) / sizeof(float));
+    std::ifstream file(path, std::ios::binary);
+    if (!file.read(reinterpret_cast<char *>(values.data()), values.size() * sizeof(float))) {
+        throw std::runtime_error("Failed to read " + path.string());
+    }
+    return values;
+}
+
+/// Relative error of rounded values: |values - rounded| / |values|
+struct RelativeError {
+    double sumError = 0;
+    double sumNorm = 0;
+
+    void
+    add(const std::vector<float> &values, const std::vector<float> &rounded)
+    {
+        for (size_t i = 0; i < values.size(); ++i) {
+            sumError += double(values[i] - rounded[i]) * (values[i] - rounded[i]);
+            sumNorm += double(values[i]) * values[i];
+        }
+    }
+
+    double
+    value() const
+    {
+        return std::sqrt(sumError / std::max(sumNorm, 1e-30));
+    }
+};
+
+} // namespace
+
+/// Converts the embeddings, the convolution and the fully-connected matrices of a fp32 weights directory to fp16 or
+/// bf16, the other files are copied as they are
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+
+        auto dtype = model::half::parseDType(params.dtype);
+        std::filesystem::path input = params.pathModel;
+        std::filesystem::path output = params.pathOutput;
+        std::filesystem::create_directories(output);
+        if (std::filesystem::equivalent(input, output)) {
+            throw std::string("The output directory must differ from weights_path!");
+        }
+
+        for (auto &entry : std::filesystem::directory_iterator(input)) {
+            auto name = entry.path().filename().string();
+            if (!entry.is_regular_file() || name == "embeddings.bin") {
+                continue;
+            }
+            if (name != "conv_matrix.bin" && name != "fc_matrices.bin") {
+                std::filesystem::copy_file(entry.path(), output / name,
+                                           std::filesystem::copy_options::overwrite_existing);
+                continue;
+            }
+
+            auto values = readFloats(entry.path());
+            std::vector<uint16_t> halfValues(values.size());
+            model::half::narrow(dtype, values.data(), values.size(), halfValues.data());
+            std::ofstream file(output / name, std::ios::binary);
+            file.write(reinterpret_cast<const char *>(halfValues.data()), halfValues.size() * sizeof(uint16_t));
+            if (!file) {
+                throw std::runtime_error("Failed to write " + (output / name).string());
+            }
+
+            std::vector<float> rounded(values.size());
+            model::half::widen(dtype, halfValues.data(), halfValues.size(), rounded.data());
+            RelativeError error;
+            error.add(values, rounded);
+            std::cout << name << ": " << values.size() * sizeof(float) << " -> "
+                      << halfValues.size() * sizeof(uint16_t) << " bytes, relative error " << error.value() << "\n";
+        }
+
+        auto embeddings = model::loadEmbeddings(input / "embeddings.bin");
+        model::saveEmbeddings(output / "embeddings.bin", embeddings, dtype);
+        auto converted = model::loadEmbeddings(output / "embeddings.bin", {}, dtype);
+        std::vector<float> values(embeddings.dim()), rounded(embeddings.dim());
+        RelativeError error;
+        for (size_t row = 0; row < embeddings.size(); ++row) {
+            embeddings.decode(row, values.data());
+            converted.decode(row, rounded.data());
+            error.add(values, rounded);
+        }
+        std::cout << "embeddings.bin: " << embeddings.bytes() << " -> " << converted.bytes()
+                  << " bytes, relative error " << error.value() << std::endl;
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
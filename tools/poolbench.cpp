@@ -0,0 +1,244 @@
+#include <support/ArgParser/ArgParser.h>
+#include <support/ThreadPool/ThreadPool.h>
+#include <support/ThreadPool/ThreadSafeQueue.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <semaphore>
+#include <string>
+#include <type_traits>
+
+struct Parameters : public argparser::Arguments {
+    // pool sizes to compare, oversubscribing the cores is part of the test
+    std::vector<size_t> threads = {1, 2, 4, 8, 16, 32, 64};
+    // tasks of each run
+    size_t numTasks = 100000;
+    // iterations of a medium task, a tiny one does 8
+    size_t mediumWork = 4000;
+    // the best of this many runs is reported
+    size_t repeats = 3;
+    // pause instructions an idle worker of the work-stealing pool spins for before it sleeps
+    size_t spinRounds = threadpool::ThreadPool::defaultSpinRounds;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"threads">(threads, UnconstrainedArgument<std::vector<size_t>>(), false);
+        addParam<"tasks">(numTasks, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"medium_work">(mediumWork, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"repeats">(repeats, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"spin">(spinRounds, RangeArgument<size_t>({0, INT_MAX}), false);
+    }
+};
+
+namespace
+{
+
+/// The previous pool, kept as the baseline: a mutex-protected queue per worker, round-robin submission through a
+/// shared queue of worker ids and a semaphore per worker
+class LockingPool
+{
+    struct Task {
+        threadpool::ThreadSafeQueue<std::move_only_function<void()>> tasks{};
+        std::binary_semaphore semaphore{0};
+    };
+
+    std::vector<std::jthread> threads;
+    std::vector<Task> tasks;
+    threadpool::ThreadSafeQueue<size_t> workers;
+    std::atomic_int waitingTasks = 0;
+    std::atomic_int totalLeftTasks = 0;
+    std::atomic_bool doneThreads = false;
+
+  public:
+    explicit LockingPool(size_t numThreads) : tasks(numThreads)
+    {
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers.push(size_t(i));
+            threads.emplace_back([&, i](const std::stop_token &stop_tok) {
+                while (!stop_tok.stop_requested()) {
+                    tasks[i].semaphore.acquire();
+                    while (waitingTasks.load(std::memory_order_acquire) > 0) {
+                        while (auto task = tasks[i].tasks.pop()) {
+                            waitingTasks.fetch_sub(1, std::memory_order_release);
+                            std::invoke(std::move(task.value()));
+                            totalLeftTasks.fetch_sub(1, std::memory_order_release);
+                        }
+                        for (size_t j = 1; j < tasks.size(); ++j) {
+                            if (auto task = tasks[(i + j) % tasks.size()].tasks.pop()) {
+                                waitingTasks.fetch_sub(1, std::memory_order_release);
+                                std::invoke(std::move(task.value()));
+                                totalLeftTasks.fetch_sub(1, std::memory_order_release);
+                                break;
+                            }
+                        }
+                    }
+                    if (totalLeftTasks.load(std::memory_order_acquire) == 0) {
+                        doneThreads.store(true, std::memory_order_release);
+                        doneThreads.notify_one();
+                    }
+                }
+            });
+        }
+    }
+
+    template <typename Func>
+    std::future<void>
+    addTask(Func f)
+    {
+        std::promise<void> promise;
+        auto fut = promise.get_future();
+        auto i = workers.pop().value();
+        workers.push(size_t(i));
+        if (totalLeftTasks == 0) {
+            doneThreads.store(false, std::memory_order_release);
+        }
+        totalLeftTasks.fetch_add(1, std::memory_order_release);
+        waitingTasks.fetch_add(1, std::memory_order_release);
+        tasks[i].tasks.push([func = std::move(f), promise = std::move(promise)]() mutable {
+            func();
+            promise.set_value();
+        });
+        tasks[i].semaphore.release();
+        return fut;
+    }
+
+    ~LockingPool()
+    {
+        if (totalLeftTasks.load(std::memory_order_acquire) > 0) {
+            doneThreads.wait(false);
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].request_stop();
+            tasks[i].semaphore.release();
+            threads[i].join();
+        }
+    }
+};
+
+/// A task's work: a dependent chain of multiplications the compiler can't remove
+void
+spin(size_t iterations)
+{
+    uint64_t x = iterations;
+    for (size_t i = 0; i < iterations; ++i) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        asm volatile("" : "+r"(x));
+    }
+}
+
+/// One timed run
+struct Run {
+    double ms = std::numeric_limits<double>::max();
+    // workers of the work-stealing pool
+    threadpool::ThreadPool::Stats stats;
+};
+
+/// Function that times one run: from the first added task until the pool is destroyed
+/// @param nested - the main thread adds one task per worker and those add the rest from inside the pool, otherwise the
+/// main thread adds all of them
+template <typename Pool>
+Run
+timeRun(const Parameters &params, size_t numThreads, size_t work, bool nested)
+{
+    Run run;
+    auto numTasks = params.numTasks;
+    std::unique_ptr<Pool> pool;
+    if constexpr (std::is_same_v<Pool, threadpool::ThreadPool>) {
+        pool = std::make_unique<Pool>(numThreads, params.spinRounds);
+    } else {
+        pool = std::make_unique<Pool>(numThreads);
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (nested) {
+        auto *p = pool.get();
+        for (size_t t = 0; t < numThreads; ++t) {
+            auto count = numTasks / numThreads + (t < numTasks % numThreads);
+            p->addTask([p, count, work] {
+                for (size_t i = 0; i < count; ++i) {
+                    p->addTask([work] { spin(work); });
+                }
+            });
+        }
+    } else {
+        for (size_t i = 0; i < numTasks; ++i) {
+            pool->addTask([work] { spin(work); });
+        }
+    }
+    if constexpr (std::is_same_v<Pool, threadpool::ThreadPool>) {
+        pool->wait();
+        run.stats = pool->stats();
+    }
+    pool.reset();
+    run.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return run;
+}
+
+template <typename Pool>
+Run
+bestRun(const Parameters &params, size_t numThreads, size_t work, bool nested)
+{
+    Run best;
+    for (size_t r = 0; r < params.repeats; ++r) {
+        auto run = timeRun<Pool>(params, numThreads, work, nested);
+        if (run.ms < best.ms) {
+            best = run;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+/// Compares the contention of the work-stealing threadpool::ThreadPool and the previous mutex-based pool: tasks are
+/// added either by the main thread or by the pool's own tasks
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+
+        // the last columns are the idle time, the spins that found a task, the sleeps and the wakeups of the
+        // work-stealing pool's workers
+        std::cout << std::setw(8) << "threads" << std::setw(8) << "task" << std::setw(10) << "added by"
+                  << std::setw(12) << "locking ms" << std::setw(12) << "stealing ms" << std::setw(10) << "speedup"
+                  << std::setw(10) << "idle ms" << std::setw(10) << "spin hits" << std::setw(10) << "parks"
+                  << std::setw(10) << "wakeups" << std::endl;
+        std::cout << std::fixed << std::setprecision(2);
+        for (auto numThreads : params.threads) {
+            if (numThreads == 0) {
+                throw std::string("A pool needs at least one thread!");
+            }
+            for (auto [name, work] : {std::pair<std::string, size_t>{"tiny", 8}, {"medium", params.mediumWork}}) {
+                for (bool nested : {false, true}) {
+                    auto locking = bestRun<LockingPool>(params, numThreads, work, nested);
+                    auto stealing = bestRun<threadpool::ThreadPool>(params, numThreads, work, nested);
+                    std::cout << std::setw(8) << numThreads << std::setw(8) << name << std::setw(10)
+                              << (nested ? "tasks" : "main") << std::setw(12) << locking.ms << std::setw(12)
+                              << stealing.ms << std::setw(10) << locking.ms / stealing.ms << std::setw(10)
+                              << stealing.stats.idleSeconds * 1000 << std::setw(10) << stealing.stats.spinHits
+                              << std::setw(10) << stealing.stats.parks << std::setw(10) << stealing.stats.wakeups
+                              << std::endl;
+                }
+            }
+        }
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <model/ProductQuantization.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+
+struct Parameters : public argparser::Arguments {
+    std::string pathEmbeddings;
+    std::string pathOutput;
+    size_t numSubspaces = 48;
+    size_t numCentroids = 256;
+    size_t iterations = 10;
+    // rows the codebooks are learned on
+    size_t sampleSize = 65536;
+    size_t seed = 0;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"embeddings">(pathEmbeddings, FileArgument<std::string>());
+        addParam<"output">(pathOutput, FileArgument<std::string>(false));
+        addParam<"subspaces">(numSubspaces, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"centroids">(numCentroids, RangeArgument<size_t>({1, 256}), false);
+        addParam<"iterations">(iterations, RangeArgument<size_t>({0, INT_MAX}), false);
+        addParam<"sample">(sampleSize, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"seed">(seed, RangeArgument<size_t>({0, INT_MAX}), false);
+    }
+};
+
+/// Converts embeddings.bin (word2vec binary format) into a product-quantized table
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+
+        auto embeddings = model::loadEmbeddings(params.pathEmbeddings);
+        auto codebook = model::pq::train(embeddings, params.numSubspaces, params.numCentroids, params.iterations,
+                                         params.sampleSize, params.seed);
+        auto quantized = model::pq::encode(embeddings, std::move(codebook));
+        model::pq::save(params.pathOutput, quantized);
+
+        // relative error of the decoded vectors
+        Eigen::VectorXf decoded(embeddings.dim());
+        double sumError = 0, sumNorm = 0;
+        for (size_t row = 0; row < embeddings.size(); ++row) {
+            quantized.decode(row, decoded.data());
+            sumError += (decoded - embeddings.row(row)).squaredNorm();
+            sumNorm += embeddings.row(row).squaredNorm();
+        }
+
+        std::cout << "Embeddings: " << embeddings.size() << " path-tokens, " << embeddings.dim() << " dimensions\n"
+                  << "Codes: " << params.numSubspaces << " subspaces of " << quantized.pqCodebook().numCentroids
+                  << " centroids\n"
+                  << "Memory: " << embeddings.bytes() << " -> " << quantized.bytes() << " bytes\n"
+                  << "Relative reconstruction error: " << std::sqrt(sumError / std::max(sumNorm, 1e-30)) << std::endl;
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,546 @@
+#include <model/Model.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+#include <support/Support/Support.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct Parameters : public argparser::Arguments {
+    std::string socketPath;
+    // resident models, the first one is the default
+    std::vector<std::string> bundles;
+    // a weights directory instead of bundles
+    std::string pathModel;
+    // shapes of a weights directory, a bundle has its own
+    size_t embDim = 0;
+    size_t kernelSize = 0;
+    size_t numFilters = 0;
+    std::string pathLabelIdx;
+    // optional, lets requests name their domain
+    std::string pathDomainIdx;
+    std::string lang;
+    size_t minLen;
+    double threshold;
+    size_t numThreads = 1;
+    size_t maxBatch = 16;
+    // how long a worker waits for a batch to fill up
+    size_t batchWaitUs = 1000;
+    // "off": one product per batch, "lazy"/"full": per-token projection tables (see model::ProjectionTable)
+    std::string projection = "off";
+    // threads per inference call, for long submissions (see model::ASTCODAModel::setIntraOpThreads)
+    size_t intraThreads = 1;
+    size_t intraMinWindows = 1024;
+    // number of cached window convolutions per model, 0: no cache
+    size_t windowCache = 0;
+    // storage type of a weights directory, see the half tool
+    std::string dtype = "fp32";
+    // longest request line, a client that sends a longer one is disconnected
+    size_t maxRequestBytes = 16 << 20;
+    // requests waiting for a worker, a full queue stops reading from the clients
+    size_t maxQueue = 256;
+    // how long a response may wait for a client that doesn't read, then the client is disconnected
+    size_t sendTimeoutMs = 1000;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"socket">(socketPath, FileArgument<std::string>(false));
+        addParam<"bundles">(bundles, UnconstrainedArgument<std::vector<std::string>>(), false);
+        addParam<"weights_path">(pathModel, DirectoryArgument<std::string>(), false);
+        addParam<"embedding_dim">(embDim, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"kernel_size">(kernelSize, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"num_filters">(numFilters, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"label_to_idx">(pathLabelIdx, FileArgument<std::string>(), false);
+        addParam<"domain_to_idx">(pathDomainIdx, FileArgument<std::string>(), false);
+        addParam<"lang">(lang, ConstrainedArgument<std::string>({"c", "cpp"}));
+        addParam<"minlen">(minLen, RangeArgument<size_t>({1, INT_MAX}));
+        addParam<"threshold">(threshold, RangeArgument<double>({-1.0, 1.0}));
+        addParam<"threads">(numThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}), false);
+        addParam<"max_batch">(maxBatch, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"batch_wait_us">(batchWaitUs, RangeArgument<size_t>({0, INT_MAX}), false);
+        addParam<"window_cache">(windowCache, RangeArgument<size_t>({0, INT_MAX}), false);
+        addParam<"intra_threads">(intraThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}),
+                                  false);
+        addParam<"intra_min_windows">(intraMinWindows, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"projection">(projection, ConstrainedArgument<std::string>({"off", "lazy", "full"}), false);
+        addParam<"dtype">(dtype, ConstrainedArgument<std::string>({"fp32", "fp16", "bf16"}), false);
+        addParam<"max_request_bytes">(maxRequestBytes, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"max_queue">(maxQueue, RangeArgument<size_t>({1, INT_MAX}), false);
+        addParam<"send_timeout_ms">(sendTimeoutMs, RangeArgument<size_t>({1, INT_MAX}), false);
+    }
+};
+
+/// Client connection
+/// @brief - responses to pipelined requests may be sent by different workers, so writes are serialized
+/// @brief - a send that times out (see setSendTimeout) disconnects the client, so a client that doesn't read can
+/// stall a worker only once
+class Connection
+{
+    int fd;
+    std::mutex writeMutex;
+    std::atomic_bool broken = false;
+
+  public:
+    explicit Connection(int fd) : fd(fd) {}
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    ~Connection()
+    {
+        close(fd);
+    }
+
+    int
+    socket() const
+    {
+        return fd;
+    }
+
+    void
+    setSendTimeout(std::chrono::milliseconds timeout)
+    {
+        timeval tv{};
+        tv.tv_sec = timeout.count() / 1000;
+        tv.tv_usec = timeout.count() % 1000 * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    /// @return whether the client has gone away or has been disconnected, its requests needn't be answered
+    bool
+    isBroken() const
+    {
+        return broken.load(std::memory_order_relaxed);
+    }
+
+    /// Function that sends one response line, a client that has gone away is ignored
+    void
+    send(const json &response)
+    {
+        auto line = response.dump() + "\n";
+        std::lock_guard lk(writeMutex);
+        for (size_t sent = 0; sent < line.size() && !isBroken();) {
+            auto n = ::send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                // also ends the reader of this client
+                broken = true;
+                shutdown(fd, SHUT_RDWR);
+                return;
+            }
+            sent += n;
+        }
+    }
+};
+
+/// One parsed request waiting for inference
+struct Request {
+    std::shared_ptr<Connection> connection;
+    json id;
+    size_t model = 0;
+    model::Document doc = {};
+    // the best domain is chosen if it is unknown
+    std::optional<size_t> domain = std::nullopt;
+    float threshold = 0;
+    Clock::time_point received = {};
+};
+
+/// Queue of requests that hands them out in batches
+/// @brief - it holds at most capacity requests, a reader waits for room so that a client can't queue without bound
+class RequestQueue
+{
+    std::mutex m;
+    std::condition_variable cv;
+    std::condition_variable notFull;
+    std::deque<Request> requests;
+    size_t capacity;
+    bool closed = false;
+
+  public:
+    explicit RequestQueue(size_t capacity) : capacity(capacity) {}
+
+    void
+    push(Request request)
+    {
+        {
+            std::unique_lock lk(m);
+            notFull.wait(lk, [&] { return requests.size() < capacity || closed; });
+            requests.push_back(std::move(request));
+        }
+        cv.notify_one();
+    }
+
+    void
+    close()
+    {
+        {
+            std::lock_guard lk(m);
+            closed = true;
+        }
+        cv.notify_all();
+        notFull.notify_all();
+    }
+
+    /// Function that waits for a request, then for up to wait more for the batch to fill up
+    /// @return up to maxBatch requests, empty if the queue is closed and drained
+    std::vector<Request>
+    popBatch(size_t maxBatch, std::chrono::microseconds wait)
+    {
+        std::unique_lock lk(m);
+        cv.wait(lk, [&] { return !requests.empty() || closed; });
+        cv.wait_for(lk, wait, [&] { return requests.size() >= maxBatch || closed; });
+
+        std::vector<Request> batch;
+        while (!requests.empty() && batch.size() < maxBatch) {
+            batch.push_back(std::move(requests.front()));
+            requests.pop_front();
+        }
+        lk.unlock();
+        notFull.notify_all();
+        return batch;
+    }
+};
+
+/// Resident inference server
+/// @brief - protocol: one JSON object per line in both directions
+/// @brief - request: {"id": any, "path": file | "source": code, "model": index (0), "domain": index or name (if
+/// absent, the one whose head gives its predicted class the highest softmax probability, see model::bestDomain),
+/// "threshold": float}
+/// @brief - response: {"id", "lines", "logits", "domain", "batch", "latency_ms"} or {"id", "error"}
+class Server
+{
+    const Parameters &params;
+    std::vector<std::unique_ptr<model::ASTCODAModel>> models;
+    std::map<std::string, size_t> domain2idx;
+    RequestQueue queue;
+
+    /// Function that turns a request line into a parsed request
+    Request
+    parseRequest(const std::shared_ptr<Connection> &connection, const json &message, Clock::time_point received)
+    {
+        Request request{.connection = connection,
+                        .id = message.value("id", json()),
+                        .model = message.value("model", size_t(0)),
+                        .threshold = message.value("threshold", float(params.threshold)),
+                        .received = received};
+        if (request.model >= models.size()) {
+            throw std::runtime_error("No model " + std::to_string(request.model));
+        }
+        auto &mod = *models[request.model];
+
+        if (auto domain = message.find("domain"); domain != message.end()) {
+            if (domain->is_string()) {
+                auto it = domain2idx.find(domain->get<std::string>());
+                if (it == domain2idx.end()) {
+                    throw std::runtime_error("Unknown domain " + domain->get<std::string>());
+                }
+                request.domain = it->second;
+            } else {
+                request.domain = domain->get<size_t>();
+            }
+            if (request.domain.value() >= mod.getNumDomains()) {
+                throw std::runtime_error("No domain " + std::to_string(request.domain.value()));
+            }
+        }
+
+        if (message.contains("source")) {
+            request.doc = mod.parseSource(message["source"].get<std::string>());
+        } else if (message.contains("path")) {
+            auto path = message["path"].get<std::string>();
+            if (!std::filesystem::is_regular_file(path)) {
+                throw std::runtime_error(path + " is not a file");
+            }
+            request.doc = mod.parse(path);
+        } else {
+            throw std::runtime_error("A request needs either \"path\" or \"source\"");
+        }
+        return request;
+    }
+
+    /// Function that reads requests of one client, parsing happens here so that it runs in parallel
+    void
+    serveConnection(std::shared_ptr<Connection> connection)
+    {
+        std::string buffer;
+        char chunk[1 << 16];
+        while (true) {
+            auto n = recv(connection->socket(), chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                return;
+            }
+            buffer.append(chunk, n);
+
+            size_t begin = 0;
+            for (auto end = buffer.find('\n'); end != std::string::npos; end = buffer.find('\n', begin)) {
+                auto received = Clock::now();
+                json message;
+                try {
+                    message = json::parse(buffer.begin() + begin, buffer.begin() + end);
+                    queue.push(parseRequest(connection, message, received));
+                } catch (const std::exception &e) {
+                    connection->send({{"id", message.is_object() ? message.value("id", json()) : json()},
+                                      {"error", e.what()}});
+                }
+                begin = end + 1;
+            }
+            buffer.erase(0, begin);
+
+            // the rest of the buffer is an unfinished line, it mustn't grow without bound
+            if (buffer.size() > params.maxRequestBytes) {
+                connection->send({{"id", json()}, {"error", "The request is longer than max_request_bytes"}});
+                return;
+            }
+        }
+    }
+
+    /// Function that answers the requests of one batch
+    void
+    process(std::vector<Request> &batch)
+    {
+        // nobody waits for the answers of a disconnected client
+        std::erase_if(batch, [](const Request &r) { return r.connection->isBroken(); });
+
+        // predictions of the requests with a known domain are computed in one batch per model
+        std::vector<model::Prediction> predictions(batch.size());
+        std::vector<size_t> domains(batch.size());
+        for (size_t m = 0; m < models.size(); ++m) {
+            std::vector<size_t> indices;
+            std::vector<const model::Document *> docs;
+            std::vector<size_t> docDomains;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (batch[i].model != m) {
+                    continue;
+                }
+                if (batch[i].domain.has_value()) {
+                    indices.push_back(i);
+                    docs.push_back(&batch[i].doc);
+                    docDomains.push_back(batch[i].domain.value());
+                } else {
+                    auto all = models[m]->predictAllDomains(batch[i].doc);
+                    domains[i] = model::bestDomain(all);
+                    predictions[i] = std::move(all[domains[i]]);
+                }
+            }
+            if (docs.empty()) {
+                continue;
+            }
+
+            auto results = models[m]->predictBatch(docs, docDomains);
+            for (size_t j = 0; j < indices.size(); ++j) {
+                predictions[indices[j]] = std::move(results[j]);
+                domains[indices[j]] = docDomains[j];
+            }
+        }
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto &r = batch[i];
+            auto lines = model::chooseLines(predictions[i], r.doc.positions, r.threshold);
+            auto &logits = predictions[i].logits;
+            auto latency = std::chrono::duration<double, std::milli>(Clock::now() - r.received).count();
+
+            r.connection->send({{"id", r.id},
+                                {"lines", lines},
+                                {"logits", std::vector<float>(logits.data(), logits.data() + logits.size())},
+                                {"domain", domains[i]},
+                                {"batch", batch.size()},
+                                {"latency_ms", latency}});
+            std::cerr << "request " << r.id.dump() << ": " << r.doc.tokens.size() << " path-tokens, batch of "
+                      << batch.size() << ", " << latency << " ms" << std::endl;
+        }
+    }
+
+  public:
+    explicit Server(const Parameters &params) : params(params), queue(params.maxQueue)
+    {
+        if (!params.pathDomainIdx.empty()) {
+            domain2idx = support::readIndex(params.pathDomainIdx);
+        }
+
+        if (params.bundles.empty() == params.pathModel.empty()) {
+            throw std::runtime_error("Exactly one of bundles and weights_path is required!");
+        }
+        if (params.bundles.empty()) {
+            if (params.pathLabelIdx.empty() || params.pathDomainIdx.empty()) {
+                throw std::runtime_error("A weights directory needs label_to_idx and domain_to_idx!");
+            }
+            if (params.embDim == 0 || params.kernelSize == 0 || params.numFilters == 0) {
+                throw std::runtime_error("A weights directory needs embedding_dim, kernel_size and num_filters!");
+            }
+            size_t numDomains = support::countLines(params.pathDomainIdx);
+            size_t numLabels = support::countLines(params.pathLabelIdx);
+            if (numDomains == 0 || numLabels % numDomains != 0) {
+                throw std::runtime_error("The labels of " + params.pathLabelIdx + " don't split into the " +
+                                         std::to_string(numDomains) + " domains of " + params.pathDomainIdx);
+            }
+            models.push_back(std::make_unique<model::ASTCODAModel>(
+                params.pathModel, params.kernelSize, params.embDim, params.numFilters, numLabels,
+                numLabels / numDomains, params.lang, params.minLen, params.threshold, 0,
+                std::unordered_set<std::string>{}, model::half::parseDType(params.dtype)));
+        }
+        for (auto &bundle : params.bundles) {
+            models.push_back(std::make_unique<model::ASTCODAModel>(std::filesystem::path(bundle), params.lang,
+                                                                   params.minLen, params.threshold));
+        }
+        std::map<std::string, model::ProjectionMode> projectionModes = {{"off", model::ProjectionMode::Off},
+                                                                         {"lazy", model::ProjectionMode::Lazy},
+                                                                         {"full", model::ProjectionMode::Full}};
+        for (auto &mod : models) {
+            mod->setWindowCache(params.windowCache);
+            mod->setIntraOpThreads(params.intraThreads, params.intraMinWindows);
+            mod->setProjection(projectionModes.at(params.projection));
+        }
+    }
+
+    /// Function that serves clients until listenFd is shut down
+    void
+    run(int listenFd)
+    {
+        std::vector<std::jthread> workers;
+        for (size_t i = 0; i < params.numThreads; ++i) {
+            workers.emplace_back([this] {
+                while (true) {
+                    auto batch = queue.popBatch(params.maxBatch, std::chrono::microseconds(params.batchWaitUs));
+                    if (batch.empty()) {
+                        return;
+                    }
+                    try {
+                        process(batch);
+                    } catch (const std::exception &e) {
+                        for (auto &r : batch) {
+                            r.connection->send({{"id", r.id}, {"error", e.what()}});
+                        }
+                    }
+                }
+            });
+        }
+
+        struct Reader {
+            std::weak_ptr<Connection> connection;
+            std::shared_ptr<std::atomic_bool> done;
+            std::jthread thread;
+        };
+        std::vector<Reader> readers;
+        while (true) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+
+            // join the readers of the clients that have gone
+            std::erase_if(readers, [](const Reader &r) { return r.done->load(); });
+
+            auto connection = std::make_shared<Connection>(fd);
+            connection->setSendTimeout(std::chrono::milliseconds(params.sendTimeoutMs));
+            auto done = std::make_shared<std::atomic_bool>(false);
+            readers.push_back({connection, done, std::jthread([this, connection, done] {
+                                   serveConnection(connection);
+                                   *done = true;
+                               })});
+        }
+
+        // stop reading, answer what has been read already
+        for (auto &r : readers) {
+            if (auto connection = r.connection.lock()) {
+                shutdown(connection->socket(), SHUT_RD);
+            }
+        }
+        readers.clear();
+        queue.close();
+        workers.clear();
+
+        if (params.windowCache != 0) {
+            for (size_t i = 0; i < models.size(); ++i) {
+                auto stats = models[i]->windowCacheStats();
+                std::cerr << "model " << i << " window cache: " << stats.hits << " hits of " << stats.lookups
+                          << " lookups (" << stats.hitRate() * 100 << "%), " << stats.size << " windows, "
+                          << stats.bytes / (1 << 20) << " MiB, " << stats.evictions << " evictions" << std::endl;
+            }
+        }
+        if (params.projection != "off") {
+            for (size_t i = 0; i < models.size(); ++i) {
+                auto stats = models[i]->projectionStats();
+                std::cerr << "model " << i << " projection tables: " << stats.tokens << " path-tokens, "
+                          << stats.bytes / (1 << 20) << " MiB" << std::endl;
+            }
+        }
+    }
+};
+
+namespace
+{
+
+std::atomic_int listenSocket = -1;
+
+void
+stop(int)
+{
+    // makes accept() fail, so the server shuts down gracefully
+    shutdown(listenSocket, SHUT_RDWR);
+}
+
+} // namespace
+
+/// Keeps models resident and answers requests over a Unix domain socket (see Server)
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+
+        Server server(params);
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (params.socketPath.size() >= sizeof(address.sun_path)) {
+            throw std::string("The socket path is too long!");
+        }
+        params.socketPath.copy(address.sun_path, params.socketPath.size());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        std::filesystem::remove(params.socketPath);
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0) {
+            throw std::string("Failed to listen on ") + params.socketPath + ": " + std::strerror(errno);
+        }
+        listenSocket = fd;
+        std::signal(SIGINT, stop);
+        std::signal(SIGTERM, stop);
+
+        std::cerr << "Listening on " << params.socketPath << std::endl;
+        server.run(fd);
+
+        close(fd);
+        std::filesystem::remove(params.socketPath);
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
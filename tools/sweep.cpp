@@ -0,0 +1,82 @@
+#include <model/Scores.h>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <support/ArgParser/ArgParser.h>
+
+struct Parameters : public argparser::Arguments {
+    std::string scoresPath;
+    std::vector<double> thresholds;
+    std::string outDir;
+
+    Parameters()
+    {
+        using namespace argparser;
+
+        addParam<"scores">(scoresPath, FileArgument<std::string>());
+        addParam<"thresholds">(thresholds, UnconstrainedArgument<std::vector<double>>());
+        addParam<"outdir">(outDir, DirectoryArgument<std::string>(false));
+    }
+};
+
+/// Produces chosen_lines for many thresholds from the scores written by evaluate, without running the model
+/// >> outdir/chosen_lines_<threshold>.txt
+int
+main(int argc, char *argv[])
+{
+    try {
+        Parameters params;
+        params.fromJSON(argv[1]);
+
+        auto start = std::chrono::steady_clock::now();
+        auto files = model::readScores(params.scoresPath);
+        auto read = std::chrono::steady_clock::now();
+
+        std::filesystem::path outDir = params.outDir;
+        std::filesystem::create_directories(outDir);
+        for (auto threshold : params.thresholds) {
+            if (threshold < -1.0 || threshold > 1.0) {
+                throw std::format("{} is out of the range [-1, 1]!", threshold);
+            }
+
+            // the shortest fixed-point form that reads back as the same double: distinct thresholds get distinct files
+            // (a double in [-1, 1] has at most ~330 of them)
+            char digits[512];
+            auto last = std::to_chars(digits, digits + sizeof(digits), threshold, std::chars_format::fixed).ptr;
+            auto name = "chosen_lines_" + std::string(digits, last) + ".txt";
+            std::ofstream outFile(outDir / name);
+            if (!outFile) {
+                throw "Failed to open " + (outDir / name).string();
+            }
+            size_t numLines = 0;
+            for (auto &f : files) {
+                auto lines = model::chooseLines(f.prediction, f.positions, threshold);
+                outFile << f.name;
+                for (auto &v : lines) {
+                    outFile << " " << v;
+                }
+                outFile << "\n";
+                numLines += lines.size();
+            }
+            std::cout << name << ": " << numLines << " lines" << std::endl;
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        std::cout << files.size() << " files, " << params.thresholds.size() << " thresholds: read in "
+                  << std::chrono::duration<double>(read - start).count() << " s, swept in "
+                  << std::chrono::duration<double>(end - read).count() << " s" << std::endl;
+
+    } catch (const char *err) {
+        std::cerr << err << std::endl;
+        return 1;
+    } catch (const std::string &s) {
+        std::cerr << s << std::endl;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -1,6 +1,7 @@
 #include <support/ArgParser/ArgParser.h>
 #include <vocab/Vocabulary.h>
 #include <iostream>
+#include <thread>
 
 struct Parameters : public argparser::Arguments {
     std::string pathTrainX;
@@ -17,6 +18,7 @@ struct Parameters : public argparser::Arguments {
     std::string pathDomainIdx;
     std::string pathTerminalHash;
     std::vector<std::string> domainClasses;
+    size_t numThreads = 1;
 
     Parameters()
     {
@@ -36,6 +38,7 @@ struct Parameters : public argparser::Arguments {
         addParam<"label_to_idx">(pathLabelIdx, FileArgument<std::string>(false));
         addParam<"domain_to_idx">(pathDomainIdx, FileArgument<std::string>(false));
         addParam<"hash_to_terminal">(pathTerminalHash, FileArgument<std::string>(false));
+        addParam<"threads">(numThreads, RangeArgument<size_t>({1, std::thread::hardware_concurrency()}), false);
     }
 };
 
@@ -47,7 +50,7 @@ main(int argc, char *argv[])
         Parameters params;
         params.fromJSON(argv[1]);
 
-        vocabulary::Vocabulary vocab(params.domainClasses);
+        vocabulary::Vocabulary vocab(params.domainClasses, params.numThreads);
 
         vocab.addTokens(params.pathTrainX);
         vocab.addTokens(params.pathValidX);